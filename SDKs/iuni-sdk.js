@@ -4,10 +4,18 @@
 
 const version = "0.9.1" // 2025.06.01
 
-function connect(selected_db) {
+function connect(selected_db, options) {
 
 	const net = require('net')
 	const PORT = 7212
+	
+	/* binary protocol: negotiated with PROTO at the first request when options.protocol is "binary" */
+	const BIN_MAGIC = 0xFF
+	const OPCODES = ["", "GET", "SET", "IS", "DEL", "UPD", "DROP", "TREE", "TREEN", "COUNT", "USE", "COMPACT", "DBLIST", "PROTO", "test"]
+	const STATUSES = [null, "-1", "-2", "Unknown command.", "<busy>"]
+	const BUSY = "<busy>" // server admission queue full: retry later or on a replica
+	let protocol = options?.protocol ?? "text"
+	let negotiated = null
 
 	function iuni_tcp_encode(s) {
 		return s.toString()
@@ -19,14 +27,14 @@ function connect(selected_db) {
 		return new Promise((resolve, reject) => {
 			const client = net.createConnection({ port: PORT, /*highWaterMark: 50384 */})
 			
-			let data = ""
+			let chunks = []
 
 			client.on('data', (chunk) => {
-				data += chunk.toString()
+				chunks.push(chunk)
 			})
 			
 			client.on('end', () => {
-				resolve(data)
+				resolve(Buffer.concat(chunks))
 				client.destroy()
 			})
 
@@ -50,48 +58,170 @@ function connect(selected_db) {
 			action.toUpperCase(),
 			...keys
 				.map(i => iuni_tcp_encode(i))
-				.map((i, index) => wilds?.includes(index) ? i : i.replaceAll("*", "\\*"))
+				.map((i, index) => wilds?.includes(index) ? i : i.replaceAll("*", "\\*").replaceAll("{", "\\{"))
 		].join("\n")
 
 		const req = String(body.length).padStart(8, '0') + "\n" + body
-		return makeRequest(req)
+		return makeRequest(req).then(res => res.toString())
+	}
+	
+	function putVarint (bytes, n) {
+		while (n >= 0x80) {
+			bytes.push((n & 0x7F) | 0x80)
+			n = Math.floor(n / 128)
+		}
+		bytes.push(n)
+	}
+	
+	function getVarint (buf, pos) {
+		let n = 0, mul = 1
+		while (true) {
+			const b = buf[pos.at++]
+			n += (b & 0x7F) * mul
+			if (!(b & 0x80)) return n
+			mul *= 128
+		}
+	}
+	
+	function bcmd (action, keys) { /* resolves to {status, tokens}, tokens are raw strings */
+		if (!keys) keys = []
+		action = action.toUpperCase()
+		let opcode = OPCODES.indexOf(action)
+		const tokens = [selected_db ?? "default"]
+		if (opcode <= 0) {
+			opcode = 0
+			tokens.push(action)
+		}
+		tokens.push(...Array.from(keys)
+			.map(i => i.toString())
+			.map((i, index) => wilds?.includes(index) ? i : i.replaceAll("*", "\\*").replaceAll("{", "\\{")))
+		
+		const head = [opcode]
+		putVarint(head, tokens.length)
+		const parts = [Buffer.from(head)]
+		for (const t of tokens) {
+			const b = Buffer.from(t)
+			const len = []
+			putVarint(len, b.length)
+			parts.push(Buffer.from(len), b)
+		}
+		const body = Buffer.concat(parts)
+		const frame = [BIN_MAGIC]
+		putVarint(frame, body.length)
+		
+		return makeRequest(Buffer.concat([Buffer.from(frame), body])).then(res => {
+			if (res[0] !== BIN_MAGIC) return { status: res.toString() === BUSY ? 4 : 1, tokens: [] }
+			const pos = { at: 1 }
+			getVarint(res, pos) // frame length
+			const status = res[pos.at++]
+			const count = getVarint(res, pos)
+			const out = []
+			for (let i=0; i<count; i++) {
+				const len = getVarint(res, pos)
+				out.push(res.toString('utf8', pos.at, pos.at + len))
+				pos.at += len
+			}
+			return { status, tokens: out }
+		})
+	}
+	
+	function binary () {
+		if (protocol !== "binary") return Promise.resolve(false)
+		if (!negotiated)
+			negotiated = cmd("proto", []).then(res => res.split("\n").includes("binary"))
+		return negotiated
+	}
+	
+	function exec (action, keys) { /* scalar answer as string, whatever the protocol */
+		return binary().then(bin => !bin ? cmd(action, keys) :
+			bcmd(action, keys).then(res => STATUSES[res.status] ?? res.tokens[0] ?? ""))
 	}
 
 	/* core */
 	
 
+	/* get(...keys, { prefix }) or get(...keys, { range: [lo, hi] }): the sons in token order;
+	   get(...keys, { gt, gte, lt, lte, order: "asc" | "desc" }): the sons that are numbers, by value; limit goes with all */
 	function get(...keys) {
-		return cmd("get", keys).then(res => {
-			let arr = res.split("\n").map(i => JSON.parse('"' + i.replaceAll("\"", "\\\"") + '"'))
-			return arr
-		})
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : null
+		if (o) keys = [...keys.map(i => i.toString() === ":" ? "\\:" : i), ":", ...[
+			...(o.prefix !== undefined ? ["PREFIX", o.prefix] : []),
+			...(o.range ? ["RANGE", ...o.range] : []),
+			...(o.gt !== undefined ? [">", o.gt] : []),
+			...(o.gte !== undefined ? [">=", o.gte] : []),
+			...(o.lt !== undefined ? ["<", o.lt] : []),
+			...(o.lte !== undefined ? ["<=", o.lte] : []),
+			...(o.order ? ["ORDER", "BY", "VALUE", o.order.toUpperCase()] : []),
+			...(o.limit !== undefined ? ["LIMIT", o.limit] : [])
+		].map(String)]
+		return binary().then(bin => bin ? bcmd("get", keys).then(res => res.tokens) :
+			cmd("get", keys).then(res => {
+				let arr = res.split("\n").map(i => JSON.parse('"' + i.replaceAll("\"", "\\\"") + '"'))
+				return arr
+			}))
 	}
 	
-	function dump() {
-		return cmd("dump", [])
+	function count (...keys) { /* count(...keys, { deep }): the sons, or the whole subtree */
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : null
+		if (o?.deep) keys = [...keys.map(i => i.toString() === ":" ? "\\:" : i), ":", "DEEP"]
+		return exec("count", keys).then(res => res === BUSY ? res : Number(res))
+	}
+	
+	function mget (...paths) { /* mget([...keys], [...keys], ...): the nodes of each path in one request, null if missing */
+		const keys = paths.flatMap((p, i) => [...(i > 0 ? [";"] : []), ...p.map(k => k.toString() === ";" ? "\\;" : k)])
+		return binary().then(bin => bin
+			? bcmd("mget", keys).then(res => res.status === 0 ? res.tokens : STATUSES[res.status])
+			: cmd("mget", keys).then(res => res.split("\n").map(i => JSON.parse('"' + i.replaceAll("\"", "\\\"") + '"'))))
+			.then(res => {
+				if (!Array.isArray(res)) return res
+				const out = []
+				for (let at = 0; at < res.length; ) {
+					const n = Number(res[at++])
+					out.push(n < 0 ? null : res.slice(at, at + n))
+					at += Math.max(n, 0)
+				}
+				return out
+			})
+	}
+	
+	function load (file) { /* bulk import of a file of the server: resolves { rows, links, ms, rows_per_s } */
+		return cmd("load", [file]).then(res => res === "-1" || res === BUSY ? res :
+			Object.fromEntries(res.split("\n").map(i => i.split(" ")).map(([k, v]) => [k, Number(v)])))
+	}
+	
+	function dump (...keys) { /* dump(...keys, { binary }): the subtree as an object, with binary the raw records as a Buffer */
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : {}
+		keys = keys.map(i => iuni_tcp_encode(i)).map(i => i === ":" ? "\\:" : i.replaceAll("*", "\\*").replaceAll("{", "\\{"))
+		const body = ["USE", selected_db ?? "default", "DUMP", ...keys, ...(o.binary ? [":", "BINARY"] : [])].join("\n")
+		return makeRequest(String(Buffer.byteLength(body)).padStart(8, '0') + "\n" + body).then(res =>
+			o.binary || res.toString() === "-1" ? res : JSON.parse(res.toString()))
 	}
 
-	async function set (...keys) {
-		return cmd("set", keys)
+	async function set (...keys) { /* set(...keys, { ex }): the last node deleted after ex seconds */
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : null
+		if (o?.ex !== undefined) keys = [...keys, ":", "EX", String(o.ex)]
+		return exec("set", keys)
 	}
 
 	function is (...keys) {
-		return cmd("is", keys)
+		return exec("is", keys)
 	}
 
 	function drop () {
-		return cmd("drop", [])
+		return exec("drop", [])
 	}
 
 	function del (...keys) {
-		return cmd("del", keys)
+		return exec("del", keys)
 	}
 
-	function tree (...keys) {
-		return cmd("tree", keys).then(res => {
+	function tree (...keys) { /* tree(...keys, { limit }): "<too large> <nodes>" if over limit nodes */
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : null
+		if (o?.limit !== undefined) keys = [...keys.map(i => i.toString() === ":" ? "\\:" : i), ":", "LIMIT", String(o.limit)]
+		return exec("tree", keys).then(res => {
 			// console.log(">>", res)
 			
-			if (res === "<empty>") return res
+			if (res === "<empty>" || res.startsWith("<too large>")) return res
 
 			let v = res.split("\n");
 			
@@ -125,7 +255,7 @@ function connect(selected_db) {
 	
 	function upd (...keys) {
 		return ({with: function(...newkeys) {
-			return cmd("upd", [
+			return exec("upd", [
 				...keys.map(i => i.replaceAll(":", "\\:")),
 				":" , 
 				...newkeys.map(i => i.replaceAll(":", "\\:"))
@@ -133,16 +263,137 @@ function connect(selected_db) {
 		}})
 	}
 	
+	function move (...keys) { /* move(...keys).to(...newkeys): the node, with its subtree, at the new path; 1 moved, 0 if the new path is taken */
+		return ({to: function(...newkeys) {
+			return exec("move", [
+				...keys.map(i => i.toString() === ":" ? "\\:" : i),
+				":",
+				...newkeys.map(i => i.toString() === ":" ? "\\:" : i)
+				]).then(res => res === BUSY ? res : Number(res))
+		}})
+	}
+	
+	function rename (...keys) { /* rename(...keys).to(node): move under the same parent */
+		return ({to: function(node) {
+			return exec("rename", [...keys.map(i => i.toString() === ":" ? "\\:" : i), ":", node.toString() === ":" ? "\\:" : node])
+				.then(res => res === BUSY ? res : Number(res))
+		}})
+	}
+	
+	function copy (...keys) { /* copy(...keys).to(...newkeys): a copy of the subtree at the new path; the nodes copied, 0 if the new path is taken */
+		return ({to: function(...newkeys) {
+			return exec("copy", [
+				...keys.map(i => i.toString() === ":" ? "\\:" : i),
+				":",
+				...newkeys.map(i => i.toString() === ":" ? "\\:" : i)
+				]).then(res => res === BUSY ? res : Number(res))
+		}})
+	}
+	
+	function resolve (...keys) { /* a handle "@id.gen" of the node, to pass as the first key of the next calls (get(h, ...keys)); "-1" if missing */
+		return exec("resolve", keys)
+	}
+	
+	function expire (...keys) { /* expire(...keys).in(seconds): the nodes deleted after the seconds (0: never); the nodes matched */
+		return ({in: function(seconds) {
+			return exec("expire", [...keys.map(i => i.toString() === ":" ? "\\:" : i), ":", String(seconds)])
+				.then(res => res === BUSY ? res : Number(res))
+		}})
+	}
+	
+	function ttl (...keys) { /* the seconds left to the node, -1 if it has none, -2 if missing */
+		return exec("ttl", keys).then(res => res === BUSY ? res : Number(res))
+	}
+	
+	function multi () { /* multi().set(...).del(...).exec(): one lock, one atomic journal unit */
+		const keys = []
+		const tx = {
+			exec: () => binary().then(bin => bin
+				? bcmd("multi", keys).then(res => res.status === 0 ? res.tokens : STATUSES[res.status])
+				: cmd("multi", keys).then(res => res === "-1" ? res : res.split("\n")))
+		}
+		for (const action of ["set", "del", "is", "count", "drop"]) {
+			tx[action] = (...k) => {
+				if (keys.length > 0) keys.push(";")
+				keys.push(action.toUpperCase(), ...k.map(i => i.toString() === ";" ? "\\;" : i))
+				return tx
+			}
+		}
+		return tx
+	}
+	
+	function scan (...keys) { /* scan(...keys, { cursor, count, offset, deep }) resolves { cursor, nodes }, cursor "0" when done; deep nodes are { depth, node } */
+		const o = typeof keys[keys.length-1] === "object" ? keys.pop() : {}
+		const options = [":", "CURSOR", o.cursor ?? "0", "COUNT", o.count ?? 100, "OFFSET", o.offset ?? 0, ...(o.deep ? ["DEEP"] : [])]
+		const args = [...keys.map(i => i.toString() === ":" ? "\\:" : i), ...options.map(String)]
+		return binary().then(bin => bin
+			? bcmd("scan", args).then(res => res.status === 0 ? res.tokens : STATUSES[res.status])
+			: cmd("scan", args).then(res => res === "-1" ? res : res.split("\n").map(i => JSON.parse('"' + i.replaceAll("\"", "\\\"") + '"'))))
+			.then(res => {
+				if (!Array.isArray(res)) return res
+				const [cursor, ...nodes] = res
+				return { cursor, nodes: !o.deep ? nodes : nodes.map(i => ({ depth: Number(i.slice(0, i.indexOf(" "))), node: i.slice(i.indexOf(" ") + 1) })) }
+			})
+	}
+	
+	function watch (...keys) { /* watch(...keys, onEvent): onEvent({ type, path, to }) at each change of the subtree, returns { close } */
+		const onEvent = keys.pop()
+		const body = [
+			"USE", selected_db ?? "default",
+			"WATCH",
+			...keys
+				.map(i => iuni_tcp_encode(i))
+				.map((i, index) => wilds?.includes(index) ? i : i.replaceAll("*", "\\*").replaceAll("{", "\\{"))
+		].join("\n")
+		const decode = (line) => line.replace(/\\(.)/g, (m, c) => c === "n" ? "\n" : c)
+		const literal = (tokens) => tokens.map(i => i === "\\:" ? ":" : i)
+		
+		const client = net.createConnection({ port: PORT })
+		let buffer = Buffer.alloc(0)
+		let acked = false
+		client.on('data', (chunk) => { /* framed as the requests: 8 digits of size, endl, body */
+			buffer = Buffer.concat([buffer, chunk])
+			while (buffer.length > 8) {
+				const size = Number(buffer.toString('latin1', 0, 8))
+				if (isNaN(size)) return client.destroy() // refused
+				if (buffer.length < 9 + size) break
+				const lines = buffer.toString('utf8', 9, 9 + size).split("\n").map(decode)
+				buffer = buffer.subarray(9 + size)
+				if (!acked) { acked = true; continue }
+				const sep = lines.indexOf(":")
+				onEvent({
+					type: lines[1],
+					path: literal(sep < 0 ? lines.slice(2) : lines.slice(2, sep)),
+					to: literal(sep < 0 ? [] : lines.slice(sep + 1))
+				})
+			}
+		})
+		client.on('error', () => client.destroy())
+		client.write(String(Buffer.byteLength(body)).padStart(8, '0') + "\n" + body)
+		return { close: () => client.destroy() }
+	}
+	
+	function aggregate (fn) { /* resolves a number, null if no numbers, -1 if the path is missing */
+		return (...keys) => exec(fn, keys).then(res => res === "<empty>" ? null : res === BUSY ? res : Number(res))
+	}
+	
+	const sum = aggregate("sum"), min = aggregate("min"), max = aggregate("max"), avg = aggregate("avg")
+	
+	function stats () {
+		return cmd("stats", []).then(res => res === BUSY ? res :
+			Object.fromEntries(res.split("\n").map(i => i.split(" ")).map(([k, v]) => [k, Number(v)])))
+	}
+	
 	/* core end */
 	
 	const update = upd
 	
-	function wild(...w) { /* to set which keys have wildcards, indicating keys indexes (e.g.: 0, 1, 2, etc.) */
+	function wild(...w) { /* to set which keys have wildcards (*, **, pre*, {a,b}), indicating keys indexes (e.g.: 0, 1, 2, etc.) */
 		wilds = w
 		return aclient
 	}
 	
-	const aclient = { get, set, is, del, drop, tree, upd, update, wild, dump }
+	const aclient = { get, set, is, del, drop, tree, upd, update, move, rename, copy, resolve, expire, ttl, wild, dump, stats, multi, watch, scan, count, mget, load, sum, min, max, avg, BUSY }
 
 	return aclient
 }
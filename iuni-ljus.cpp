@@ -36,11 +36,19 @@
 #include <atomic>
 #include <tuple>
 #include <filesystem>
+#include <set>
+#include <limits>
+#include <cmath>
+#include <algorithm>
+#include <list>
 using namespace std;
 #include "utils.h"
 #include "tcp.h"
 #include "cli.h"
 #include "spinlock.h"
+#include "pool.h"
+#include "wheel.h"
+#include <fcntl.h>
 
 class Bean;
 map<string, Bean>::iterator HEND;
@@ -52,6 +60,10 @@ public:
 	map<string, Bean>::iterator	last = HEND; // last son
 	map<string, Bean>::iterator	prev = HEND; // previous brother
 	map<string, Bean>::iterator	next = HEND; // next brother
+	Iter* up = nullptr; // parent link, none for the root
+	long sons = 0;
+	long descendants = 0; // the whole subtree, sons included
+	long stamp = 0; // bumped by each change in the subtree: the replies cached on the link (--cache) hold while it is the same
 };
 
 class Bean {
@@ -94,6 +106,136 @@ public:
 	}
 };
 
+/* a change of the data, pushed to the watchers of the paths it touches */
+struct WatchEvent {
+	string type; // SET, DEL, UPD, MOVE, DROP
+	vector<string> path;
+	vector<string> to; // UPD: the nodes replacing the last one of the path, MOVE: the new path
+};
+
+/* WATCH subscriptions: for each database a trie of the watched paths, "*" matching any node.
+   An event reaches the watchers on the path's prefixes and, for removals, also those below it. */
+class Watchers {
+	struct Node {
+		map<string, Node> sons; // a literal * is kept as \*
+		vector<int> sockets;
+	};
+	struct Watcher {
+		string db;
+		bool binary; // events framed as in the binary protocol
+		vector<vector<string>> paths;
+	};
+	
+	mutex mtx;
+	map<string, Node> tries; // database x trie
+	map<int, Watcher> watchers; // socket x subscriptions
+	atomic<int> count{0};
+	
+	void collect(Node&, const vector<string>&, size_t, bool, set<int>&);
+	void all(Node&, set<int>&);
+	bool unwatch(Node&, const vector<string>&, size_t, int);
+	void drop(int); // stop and close a watcher
+public:
+	bool empty() { return count == 0; } // no lock: nothing to collect on the write path
+	void add(const string& db, const vector<vector<string>>& paths, int socket, bool binary);
+	void deliver(const string& db, vector<WatchEvent>& events);
+} WATCHERS;
+
+/* a path compiled once into steps: node (\* \{ for a literal * {), * any node, ** any depth (none included), {a,b} one of, pre* prefix */
+class PathPattern {
+public:
+	enum Kind { LITERAL, ONE_OF, ANY, PREFIX, DEEP }; // from ANY on, the step selects existing nodes only
+	struct Step {
+		Kind kind;
+		vector<string> tokens; // LITERAL and PREFIX: one, ONE_OF: the alternatives
+	};
+	vector<Step> steps;
+	int deeps = 0;
+	
+	PathPattern() {}
+	PathPattern(const vector<string>& keys) {
+		for (auto& k : keys) {
+			steps.push_back(compile(k));
+			if (steps.back().kind == DEEP) deeps++;
+		}
+	}
+	
+	bool selector(size_t i) const {
+		return steps[i].kind >= ANY;
+	}
+	
+	bool literal() const {
+		for (auto& s : steps) if (s.kind != LITERAL) return false;
+		return true;
+	}
+	
+	static string unescape(const string& k) {
+		string z;
+		for (size_t i = 0; i < k.size(); i++) {
+			if (k[i] == '\\' and i + 1 < k.size() and strchr("*{},", k[i+1])) i++;
+			z += k[i];
+		}
+		return z;
+	}
+	
+	static Step compile(const string& k) {
+		size_t n = k.size();
+		if (k == "*") return {ANY, {}};
+		if (k == "**") return {DEEP, {}};
+		if (n > 2 and k[0] == '{' and k[n-1] == '}' and k[n-2] != '\\') {
+			Step s{ONE_OF, {}};
+			string alt;
+			for (size_t i = 1; i + 1 < n; i++) {
+				if (k[i] == '\\' and i + 2 < n) { alt += k[i]; alt += k[++i]; continue; }
+				if (k[i] != ',') { alt += k[i]; continue; }
+				if (!Utils::contains(s.tokens, unescape(alt))) s.tokens.push_back(unescape(alt));
+				alt = "";
+			}
+			if (!Utils::contains(s.tokens, unescape(alt))) s.tokens.push_back(unescape(alt));
+			return s;
+		}
+		if (n > 1 and k[n-1] == '*' and k[n-2] != '\\') return {PREFIX, {unescape(k.substr(0, n-1))}};
+		return {LITERAL, {unescape(k)}};
+	}
+};
+
+/* GET/COUNT <path> : PREFIX p | RANGE lo hi | [> x] [< y] [ORDER BY VALUE [DESC]], [LIMIT n], on the sons of the nodes of the path */
+struct SonsFilter {
+	bool prefix = false;
+	bool range = false;
+	string lo; // PREFIX: the prefix
+	string hi; // RANGE: both bounds included
+	bool numeric = false; // value bounds or ORDER BY VALUE: only the sons that are numbers, by value
+	double min = -numeric_limits<double>::infinity();
+	double max = numeric_limits<double>::infinity();
+	bool minOpen = false; // > rather than >=
+	bool maxOpen = false; // < rather than <=
+	bool desc = false;
+	long limit = -1;
+	bool deep = false; // COUNT: the whole subtrees
+};
+
+/* state of the matching walk: the node reached (cur, its token, its parent) at a step, and the brother to try next */
+struct MatchFrame {
+	Iter* cur;
+	map<string, Bean>::iterator node; // HEND for the start
+	Iter* parent;
+	size_t step;
+	map<string, Bean>::iterator next = HEND;
+	size_t alt = 0;
+	bool started = false;
+};
+
+/* state of a subtree walk: a frame per level, the link walked into (its node, HEND for the start) and its son to visit next */
+struct WalkFrame {
+	Iter* link;
+	map<string, Bean>::iterator node;
+	map<string, Bean>::iterator next;
+};
+enum WalkStep { WALK__INTO, WALK__OVER, WALK__STOP }; // into the sons of the node visited, over them, or stop before it
+typedef function<WalkStep(vector<WalkFrame>&, map<string, Bean>::iterator, Iter&)> WalkVisit;
+typedef function<void(vector<WalkFrame>&, Iter&)> WalkLeave;
+
 
 class Database {
 private:
@@ -117,36 +259,157 @@ private:
 	ofstream* jfile = NULL;
 	void close();
 	
-	vector<map<string, Bean>::iterator> getSons_ (Iter);
-	map<string,bool> getSons (Iter);
-	int waterfall_delete (Iter&, int&);
+	string jbuffer; // journal lines of the running command, written by commit()
+	size_t jbegin = string::npos; // where the running atomic unit starts in jbuffer
+	int junits = 0; // begin() inside an open unit (e.g. an UPD in a MULTI) is part of it
+	int jfd = -1;
+	Uring jring;
+	int openJournalFd();
+	
 	Iter root{0}; // or Iter root = Iter(0);
+	Iter* base = &root; // where the paths of the running command start: root, or the link of its @handle
+	vector<string> based; // the path of the base, for the events
+	
+	struct Handle {
+		Iter* link;
+		vector<string> path;
+		vector<long> chain; // the ids of the link and of the ones above it, sorted
+		long since; // the generation the link was found at, the handles given before it are refused
+		long checked; // the generation up to which no link of the chain was cut or moved
+		list<long>::iterator used; // its place in handles_used
+	};
+	map<long, Handle> handles; // RESOLVE: link id x its link, trusted while its chain is untouched
+	list<long> handles_used; // the link ids of the handles, the most recently resolved or used first
+	long generation = 0; // bumped when links are cut or moved (DEL, UPD, MOVE, RENAME, DROP)
+	deque<pair<long, long>> detached; // generation x link id cut or moved at it, the last DETACHED__MAX of them
+	long detached_from = 0; // the generation the log starts after
+	void detach (long);
+	bool intact (Handle&);
+	
+	vector<map<long, Iter>::node_type> graveyard; // DEL: the links cut from the tree, with their subtrees, freed by reclaim()
+	vector<map<string, Bean>> dropped; // DROP: the whole heaps, as well
+	long backlog = 0; // links and nodes still to free
+	bool reclaiming = false; // a reclaimer thread is running
+	void reclaimLater();
+	
+	struct Expiring {
+		Iter* link;
+		map<string, Bean>::iterator node; // kept by relink()
+		long deadline; // ms since the epoch
+	};
+	map<long, Expiring> expiring; // EXPIRE, SET : EX: link id x its deadline, in the wheel too
+	TimerWheel wheel;
+	deque<TimerWheel::Timer> due; // out of the wheel, deleted by expire() a batch at a time
+	bool ticking = false; // a ticker thread is running
+	void expireLater();
+	vector<string> pathOf (Iter*, map<Iter*, vector<string>>&);
+	
+	int match (const PathPattern&, size_t, size_t, Iter*, function<void(vector<MatchFrame>&)>);
+	bool walk (vector<WalkFrame>&, long, WalkVisit, WalkLeave = nullptr);
+	int get__ (const PathPattern&, vector<Iter>&);
+	void mergeSons (vector<Iter>&, vector<string>&);
+	Iter* link (Iter*, const string&, int&, bool&);
+	Iter* link (Iter*, map<string, Bean>::iterator, int&, bool&, bool count = true);
+	void settle (Iter*, long);
+	void grow (Iter*, long);
+	Iter* attach (Iter*, map<string, Bean>::iterator, long);
+	void set__ (const PathPattern&, size_t, Iter*, vector<string>&, int&, bool);
+	void unlink (Iter*, map<string, Bean>::iterator, int&, bool journaled = true);
+	bool relink (Iter*, map<string, Bean>::iterator, Iter*, const string&);
+	Iter* locate (const vector<string>&, Iter*&, map<string, Bean>::iterator&, Iter* from = nullptr);
+	
+	struct Cached { // a reply of --cache, the most recently used first
+		string key;
+		int status;
+		bool listing;
+		vector<string> tokens;
+		vector<string> path; // of the link the reply depends on (from the root)
+		long id;
+		Iter* link;
+		long stamp; // of the link, when the reply was made
+		long generation; // at which the link was found
+		size_t bytes;
+	};
+	list<Cached> cache;
+	map<string, list<Cached>::iterator> cached; // key x entry
+	size_t cache_bytes = 0;
+	long cache_hits = 0, cache_misses = 0, cache_evictions = 0;
+	void uncache (list<Cached>::iterator);
+	
+	struct ByToken { // rows of the heap in token order, searchable by token
+		using is_transparent = void;
+		bool operator()(const map<string, Bean>::iterator& a, const map<string, Bean>::iterator& b) const { return a->first < b->first; }
+		bool operator()(const map<string, Bean>::iterator& a, const string& b) const { return a->first < b; }
+		bool operator()(const string& a, const map<string, Bean>::iterator& b) const { return a < b->first; }
+	};
+	typedef set<map<string, Bean>::iterator, ByToken> SortedSons;
+	map<long, SortedSons> sorted_sons; // parent link id x its sons by token: built at the first ordered query on the parent, then kept by link() and unlink()
+	SortedSons& sortedSons (Iter&);
+	
+	typedef pair<double, map<string, Bean>::iterator> NumericSon;
+	struct ByValue { // then by token, searchable by value
+		using is_transparent = void;
+		bool operator()(const NumericSon& a, const NumericSon& b) const { return a.first < b.first or (a.first == b.first and a.second->first < b.second->first); }
+		bool operator()(const NumericSon& a, double b) const { return a.first < b; }
+		bool operator()(double a, const NumericSon& b) const { return a < b.first; }
+	};
+	typedef set<NumericSon, ByValue> NumericSons;
+	map<long, NumericSons> numeric_sons; // parent link id x its sons that are numbers, parsed once: as sorted_sons
+	NumericSons& numericSons (Iter&);
+	void numericGet (Iter&, const SonsFilter&, size_t limit, vector<pair<double, string>>&);
+	int del__ (const PathPattern&);
 	
-	void get__ (vector<string>, vector<Iter>&, Iter, int, bool);
-	void set__ (vector<string>, int, Iter*, int&, bool);
-	void del__ (vector<string>, int, Iter*, int&, bool, vector<string> toupdate);
+	map<string, Bean>::iterator olderThan (Iter&, long, const string&, bool);
 	
-	void printSons (Iter, ostream&);
+	vector<WatchEvent> events; // of the running command, delivered by publish()
+	void notify (string, const vector<string>&, const vector<string>&);
 public:
 	tuple<int,int,int> load();
 	
 	// db data methods
 	pair<vector<string>, int> get_ (vector<string>);
+	pair<vector<string>, int> get_ (vector<string>, const SonsFilter&);
+	long aggregate_ (vector<string>, const string&, double&);
+	void mget_ (const vector<vector<string>>&, vector<pair<vector<string>, int>>&);
 	int is_ (vector<string>);
 	int set_ (vector<string>);
 	int del_ (vector<string>);
 //	int put_ (vector<string>);
-	string tree_ (vector<string>, string);
-	int count_ (vector<string>);
+	string tree_ (vector<string>, string, long depth = -1);
+	vector<WalkFrame> treeCut (Iter&, long, long);
+	void treeSlice (vector<WalkFrame>, Iter*, long, string&);
+	int scan_ (vector<string>, string&, long, long, bool, vector<pair<size_t, string>>&);
+	long count_ (vector<string>, bool deep = false);
 	int drop_();
+	long bulk_ (vector<vector<string>>&);
 	int upd_(vector<string>, vector<string>);
+	int move_ (vector<string>, vector<string>);
+	long copy_ (vector<string>, vector<string>);
+	string resolve_ (vector<string>);
+	bool rebase (const string&);
+	long expire_ (vector<string>, long);
+	long ttl_ (vector<string>);
+	
+	string cacheKey (const string&, const vector<string>&);
+	bool cacheGet (const string&, int&, bool&, vector<string>&);
+	void cachePut (const string&, const vector<string>&, int, bool, const vector<string>&);
+	vector<string> cacheStats ();
 	
 	void printHeap(ostream& strm);
 
+	bool reclaim (long);
+	long reclaimBacklog() { return backlog; }
+	bool expire (long, bool&);
+	long expiringCount() { return expiring.size(); }
+	
 	void lock() { mtx_heap.lock(); }
 	void unlock() { mtx_heap.unlock(); }
 	
 	int compact();
+	void begin(); // start of an atomic unit in the journal
+	void end(); // its end, written together with the unit by commit()
+	void commit(); // end of a command: write its journal lines (and fdatasync them if required)
+	void publish(); // then push its changes to the watchers
 	
 	Database() {}
 	void setName (string database_name) {
@@ -232,9 +495,9 @@ void Database::close() {
 		this->jfile->close();
 }
 
+/* brothers chained by link id, as they are at runtime (a new son is the last one): SCAN cursors rely on it */
 void Database::setConnections() {
 	map<long, vector<map<string, Bean>::iterator>> m; // parent x sons
-	map<long, int> cover;
 	
 	for (auto it = heap.begin(); it != heap.end(); it++) {
 		for (auto& j : it->second.son_of) {
@@ -242,31 +505,43 @@ void Database::setConnections() {
 		}
 	}
 	
+	for (auto& p : m) {
+		long parent_id = p.first;
+		auto& sons = p.second;
+		sort(sons.begin(), sons.end(), [parent_id](auto& a, auto& b) {
+			return a->second.son_of.at(parent_id).id < b->second.son_of.at(parent_id).id;
+		});
+		
+		for (size_t index = 0; index < sons.size(); index++) {
+			Iter& iter = sons[index]->second.son_of.at(parent_id);
+			if (index >= 1) iter.prev = sons[index-1];
+			if (index + 1 < sons.size()) iter.next = sons[index+1];
+		}
+	}
+	
 	for (auto& i : this->heap) {
 		for (auto& j : i.second.son_of) {
-			
-			Iter& iter = j.second;
-			
-			// A
-			auto ff = m.at(j.first);
-			
-			int index = cover[j.first];
-			if (cover.at(j.first) >= 1) {
-				iter.prev = m.at(j.first)[index-1];
-			}
-			if (cover.at(j.first) + 1 < ff.size()) {
-				iter.next = m.at(j.first)[index+1];
-			}
-			cover.at(j.first)++;
-			
-			// B
-			auto f = m.find(iter.id);
-			if (f != m.end()) iter.last = f->second.back(); // otherwise no last, aka last = HEND
+			auto f = m.find(j.second.id);
+			if (f != m.end()) j.second.last = f->second.back(); // otherwise no last, aka last = HEND
 		}
 	}
 	
-	if (!m.empty())
-		this->root.last = m.at(0).back();
+	auto f = m.find(0);
+	if (f != m.end())
+		this->root.last = f->second.back();
+	
+	/* up links and counters, depth first from the root: a subtree is summed into its parent once done */
+	root.up = nullptr;
+	root.sons = root.descendants = 0;
+	vector<WalkFrame> stack = {{&root, HEND, root.last}};
+	walk(stack, -1, [](vector<WalkFrame>& stack, map<string, Bean>::iterator, Iter& link) {
+		link.up = stack.back().link;
+		link.up->sons++;
+		link.sons = link.descendants = 0;
+		return WALK__INTO;
+	}, [](vector<WalkFrame>&, Iter& link) {
+		link.up->descendants += 1 + link.descendants;
+	});
 }
 	
 void Database::printHeap(ostream& strm) {
@@ -297,6 +572,17 @@ string webSerialize (string s) { // for pseudo-JSON
 	return quote ? ('"' + z + '"') : z;
 }
 
+/* s appended to out as webSerialize does, the runs with nothing to escape in one go */
+void webSerialize (string& out, const string& s) {
+	size_t from = 0, at;
+	while ((at = s.find_first_of("\n\\", from)) != string::npos) {
+		out.append(s, from, at - from);
+		out += s[at] == '\n' ? "\\n" : "\\\\";
+		from = at + 1;
+	}
+	out.append(s, from, string::npos);
+}
+
 string webDeserialize(string s) {
     string result = "";
     bool inEscape = false;
@@ -367,21 +653,6 @@ inline Iter& getAssociatedIter (map<string, Bean>::iterator row, long parent_id)
 }
 
 
-void Database::printSons (Iter iter, ostream& strm) {
-	vector<map<string, Bean>::iterator> v = getSons_(iter);
-	if (!v.empty()) {
-		strm <<  "{" << endl;
-	}
-	for (auto& i : v) {
-		strm << webSerialize(i->first) << endl; // probably not pure to webSerialize here, instead do it in the TCP deliver TODO
-		Iter& g = getAssociatedIter(i, iter.id);
-		printSons(g, strm);
-	}
-	if (!v.empty()) strm << "}" << endl;
-	strm.flush();
-}
-
-
 int append (string filename, string content, Database* db) {
 	if (db->jfile == NULL) {
 		db->jfile = new ofstream(filename, ios::app);
@@ -406,16 +677,86 @@ int touch (string filename, Database* db) {
 
 SpinLock sp;
 bool do_not_journal = false;
+bool io_uring_engine = false; // journal written through an io_uring
+bool journal_sync = false; // fdatasync the journal at the end of each command
 void Database::reg (bool condition, vector<string> v) {
 	if (do_not_journal) return;
 	if (!condition) return;
 	
-	string s = "";
-	for (int i=0; i<v.size(); i++) /* no need to encode here: each slug in CLI or WEB request is aleady encoded */
-		s += encodeForIuniTcpProtocol(v[i]) + (i+1 == v.size() ? "" : "|");
-	sp.lock();
-	append(jrnl, s + "\n", this);
-	sp.unlock();
+	for (size_t i=0; i<v.size(); i++) { /* no need to encode here: each slug in CLI or WEB request is aleady encoded */
+		if (i > 0) jbuffer += '|';
+		jbuffer += encodeForIuniTcpProtocol(v[i]);
+	}
+	jbuffer += '\n'; // written by commit()
+}
+
+int Database::openJournalFd() {
+	if (jfd == -1) jfd = open(jrnl.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+	return jfd;
+}
+
+/* one write of all the lines journaled by the command (and its fdatasync) */
+void Database::commit() {
+	if (jbuffer.empty()) return;
+	
+	if (openJournalFd() == -1) { // fall back to the stream
+		sp.lock();
+		append(jrnl, jbuffer, this);
+		sp.unlock();
+		jbuffer.clear();
+		return;
+	}
+	
+	int written = -1;
+	if (io_uring_engine and (jring.ready() or jring.init(4))) {
+		/* one syscall: the write and, linked after it, the fdatasync */
+		io_uring_sqe* w = jring.sqe();
+		io_uring_sqe* e = journal_sync ? jring.sqe() : w;
+		unsigned n = journal_sync ? 2 : 1;
+		if (w != nullptr and e != nullptr) {
+			w->opcode = IORING_OP_WRITE;
+			w->fd = jfd;
+			w->addr = (unsigned long)jbuffer.data();
+			w->len = jbuffer.size();
+			w->off = -1; // current position, O_APPEND anyway
+			if (journal_sync) {
+				w->flags = IOSQE_IO_LINK;
+				e->opcode = IORING_OP_FSYNC;
+				e->fd = jfd;
+				e->fsync_flags = IORING_FSYNC_DATASYNC;
+			}
+		}
+		if (w == nullptr or e == nullptr or jring.submit(n) < (int)n) { // the plain path, on a new ring next time
+			jring.release();
+			n = 0;
+		}
+		
+		int res = 0;
+		for (unsigned i = 0; i < n; i++) {
+			if (!jring.next(res)) {
+				jring.release();
+				break;
+			}
+			if (i == 0) written = res;
+		}
+		if (written == (int)jbuffer.size()) {
+			jbuffer.clear();
+			return;
+		}
+	}
+	
+	/* plain path, also completes a short io_uring write */
+	size_t at = written > 0 ? written : 0;
+	while (at < jbuffer.size()) {
+		ssize_t r = write(jfd, jbuffer.data() + at, jbuffer.size() - at);
+		if (r <= 0) {
+			cerr << "Unable to write the journal." << endl;
+			break;
+		}
+		at += r;
+	}
+	if (journal_sync) fdatasync(jfd);
+	jbuffer.clear();
 }
 
 void parseJournalLine (string content, vector<string>& tokens, const char* splitter) {
@@ -458,284 +799,1339 @@ const string OP__DROPDB = "p";
 const string OP__DEL_MA = "d";
 const string OP__DEL_NO = "e";
 const string LOG__LOAD  = "l";
+const string OP__BEGIN  = "b"; // records up to OP__COMMIT are replayed all or nothing
+const string OP__COMMIT = "c";
+const string OP__MOVE   = "v"; // v|link id|new parent link id|token: the link, with its subtree, under the new parent as the token
+const string OP__COPY   = "y"; // y|link id|new parent link id|token|first id: a copy of the subtree, as below
+const string OP__EXPIRE = "x"; // x|link id|deadline: in ms since the epoch, 0 for none
+const string OP__EXPIRED = "z"; // z|link id|link id|...: the links deleted by the ticker, as many OP__DEL_MA
+
+void Database::begin() {
+	if (junits++ > 0) return;
+	jbegin = jbuffer.size();
+	reg(true, {OP__BEGIN});
+}
 
-void 
-Database::set__ (vector<string> keys, int spanner, Iter* prev_iter, int& amt, bool nowildcard) {
-	for (int i=spanner; i<keys.size(); i++) {
-		auto& k = keys[i];
+void Database::end() {
+	if (junits == 0 or --junits > 0) return;
+	if (jbegin == string::npos) return;
+	size_t body = jbegin + OP__BEGIN.size() + 1;
+	if (jbuffer.size() <= body) jbuffer.resize(jbegin); // nothing journaled
+	else if (jbuffer.find('\n', body) + 1 == jbuffer.size()) jbuffer.erase(jbegin, body - jbegin); // one record is atomic anyway
+	else reg(true, {OP__COMMIT});
+	jbegin = string::npos;
+}
+
+void Database::notify (string type, const vector<string>& path, const vector<string>& to) {
+	if (WATCHERS.empty()) return;
+	events.push_back({type, path, to});
+	if (based.empty()) return;
+	WatchEvent& e = events.back(); // the paths of the command are from its @handle
+	e.path.insert(e.path.begin(), based.begin(), based.end());
+	if (type == "MOVE") e.to.insert(e.to.begin(), based.begin(), based.end());
+}
+
+void Database::publish() {
+	if (events.empty()) return;
+	WATCHERS.deliver(database_name, events);
+	events.clear();
+}
+
+/* depth first walk of the nodes matching the steps [from, to) of the pattern below start: one frame per level,
+   brothers followed through their links, no map nor copy of the path per level.
+   emit gets the frames, the last is the match (matchPath() for its path). Returns the literal steps missed */
+int
+Database::match (const PathPattern& p, size_t from, size_t to, Iter* start, function<void(vector<MatchFrame>&)> emit) {
+	int misses = 0;
+	set<long> seen; // ** ... ** can reach a node more than once
+	vector<MatchFrame> stack;
+	stack.reserve(to - from + 2);
+	stack.push_back({start, HEND, nullptr, from});
+	
+	while (!stack.empty()) {
+		MatchFrame& f = stack.back();
+		if (f.step == to) {
+			if (p.deeps < 2 or seen.insert(f.cur->id).second) emit(stack);
+			stack.pop_back();
+			continue;
+		}
+		const PathPattern::Step& s = p.steps[f.step];
+		MatchFrame son{nullptr, HEND, f.cur, f.step + 1};
 		
-		if (k == "*" and !nowildcard) {
-			map<string,bool> uncles = getSons(*prev_iter);
-			for (auto& u : uncles) {
-				k = u.first;
-				set__(keys, i, prev_iter, amt, true);
+		if (s.kind == PathPattern::LITERAL or s.kind == PathPattern::ONE_OF) { // straight to the node
+			if (f.alt == s.tokens.size()) {
+				stack.pop_back();
+				continue;
 			}
-			return;
+			auto b = heap.find(s.tokens[f.alt++]);
+			auto l = b == heap.end() ? map<long, Iter>::iterator() : b->second.son_of.find(f.cur->id);
+			if (b == heap.end() or l == b->second.son_of.end()) {
+				misses++;
+				continue;
+			}
+			son.cur = &l->second;
+			son.node = b;
+			stack.push_back(son);
+			continue;
 		}
-		if (!nowildcard) k = Utils::replaceAll(k, "\\*", "*");
-		nowildcard = false;
-
-//		cout << ">> " << k << endl;
-		auto ins = heap.insert({k, Bean()});
 		
-		/* */ reg(ins.second, {OP__INSERT, k});
-		long u = uuid.get();
-		auto ins2 = ins.first->second.son_of.insert({prev_iter->id, Iter(u)});
-		if (ins2.second) amt++;
-
-		if (ins2.second) {
-			ins2.first->second.prev = prev_iter->last; // the older brother of this son is the last son before this one
-			if (prev_iter->last != HEND) 
-				getAssociatedIter(prev_iter->last, prev_iter->id).next = ins.first; // the last son (if exists) has this one as the smaller brother
-			prev_iter->last = ins.first; // this is the new son
+		if (!f.started) {
+			f.started = true;
+			f.next = f.cur->last;
+			if (s.kind == PathPattern::DEEP) { // ** as no node at all, first
+				stack.push_back({f.cur, f.node, f.parent, f.step + 1});
+				continue;
+			}
 		}
-
-		/* */ long one_id = ins.first->second.getOneID({u});
-		/* */ reg(!ins.second and ins2.second, {OP__REFERENCE, to_string(one_id)});
-		/* */ reg(ins2.second, {OP__MATRIX, to_string(prev_iter->id), to_string(u)});
-		prev_iter = &ins2.first->second;
+		if (s.kind == PathPattern::PREFIX)
+			while (f.next != HEND and f.next->first.compare(0, s.tokens[0].size(), s.tokens[0]) != 0)
+				f.next = getAssociatedIter(f.next, f.cur->id).prev;
+		if (f.next == HEND) {
+			stack.pop_back();
+			continue;
+		}
+		son.node = f.next;
+		son.cur = &getAssociatedIter(f.next, f.cur->id);
+		if (s.kind == PathPattern::DEEP) son.step = f.step; // one node more, still in **
+		f.next = son.cur->prev;
+		stack.push_back(son);
 	}
+	return misses;
 }
 
+vector<string> matchPath (const vector<MatchFrame>& stack) {
+	vector<string> path;
+	for (size_t k = 1; k < stack.size(); k++)
+		if (stack[k].cur != stack[k-1].cur) path.push_back(stack[k].node->first);
+	return path;
+}
 
-int
-Database::set_ (vector<string> keys) {
-	int amt = 0;
-	set__(keys, 0, &root, amt, false);
-	return amt;
+/* depth first walk of subtrees, brothers newest first, from the state in the stack (the caller pushes the start: {link, HEND, link->last}).
+   No recursion, and no allocation per node once the stack has grown, so a caller can keep it between walks.
+   visit gets the stack, whose top is the parent (depth: size - 1), and the node with its link: WALK__INTO its sons, WALK__OVER them,
+   or WALK__STOP before it, the stack left to resume from it. leave once the sons of a node walked into are done.
+   The nodes deeper than maxDepth are not visited (-1: no limit). False if stopped */
+bool
+Database::walk (vector<WalkFrame>& stack, long maxDepth, WalkVisit visit, WalkLeave leave) {
+	while (!stack.empty()) {
+		if (stack.back().next == HEND) {
+			Iter* done = stack.back().link;
+			stack.pop_back();
+			if (leave and !stack.empty()) leave(stack, *done);
+			continue;
+		}
+		auto node = stack.back().next;
+		Iter& link = getAssociatedIter(node, stack.back().link->id);
+		WalkStep step = visit(stack, node, link);
+		if (step == WALK__STOP) return false;
+		stack.back().next = link.prev;
+		if (step == WALK__OVER) continue;
+		if (link.last != HEND and (maxDepth < 0 or (long)stack.size() <= maxDepth)) stack.push_back({&link, node, link.last});
+		else if (leave) leave(stack, link);
+	}
+	return true;
 }
 
+/* son token of parent, created if missing */
+Iter*
+Database::link (Iter* parent, const string& k, int& amt, bool& created) {
+	return link(parent, heap.try_emplace(k).first, amt, created);
+}
 
-int Database::waterfall_delete (Iter& parent_iter, int& amt) { // from = last 'last'
-	vector<map<string, Bean>::iterator> sons = getSons_(parent_iter);
+/* son node of parent (already in the heap, journaled at its first link), linked if missing.
+   Without count the subtrees of the ancestors are left to the caller, for a path at once (settle()) */
+Iter*
+Database::link (Iter* parent, map<string, Bean>::iterator node, int& amt, bool& created, bool count) {
+	bool fresh = node->second.son_of.empty(); // just put in the heap
 	
-	// recursive delete
-	for (auto& i : sons) {
-//		cout << "* " << i->first << endl;
-		Iter& grandson = getAssociatedIter(i, parent_iter.id);
-		waterfall_delete(grandson, amt);
-		
-		i->second.son_of.erase(parent_iter.id);
-		/* */ reg(true, {OP__DEL_MA, to_string(grandson.id), to_string(parent_iter.id)});
-		
-		if (i->second.son_of.empty()) {
-			heap.erase(i->first); 
-			/* */ reg(true, {OP__DEL_NO, to_string(grandson.id)});
-		}
-	}
+	/* */ if (fresh) reg(true, {OP__INSERT, node->first});
+	auto found = node->second.son_of.find(parent->id);
+	if (found != node->second.son_of.end()) return &found->second;
+	
+	long u = uuid.get();
+	Iter* son = attach(parent, node, u);
+	amt++;
+	created = true;
+	if (count) grow(parent, 1);
 	
-	return amt;	
+	/* */ if (!fresh) reg(true, {OP__REFERENCE, to_string(node->second.getOneID({u}))});
+	/* */ reg(true, {OP__MATRIX, to_string(parent->id), to_string(u)});
+	return son;
 }
 
+/* n more links (less, if negative) in the subtrees of the link and of its ancestors, all of them changed */
 void
-Database::del__ (vector<string> keys, int spanner, Iter* prev_iter, int& amt, bool nowildcard, vector<string> toupdate) {
-	for (int i=spanner; i<keys.size(); i++) {
-		auto& k = keys[i];
-
-		if (k == "*" and !nowildcard) {
-			map<string, bool> uncles = getSons(*prev_iter);
-			for (auto& u : uncles) {
-				k = u.first;
-				del__(keys, i, prev_iter, amt, true, toupdate);
-			}
-			return;
-		}
-		if (!nowildcard) Utils::replaceAll(k, "\\*", "*");
-		nowildcard = false;
+Database::grow (Iter* from, long n) {
+	for (Iter* a = from; a != nullptr; a = a->up) {
+		a->descendants += n;
+		a->stamp++;
+	}
+}
 
-		auto f = heap.find(k);
-		if (f == heap.end()) return;
+/* the subtrees of a path whose last made links (linked without count) end at deepest: one walk up, whatever the depth */
+void
+Database::settle (Iter* deepest, long made) {
+	for (long n = 0; deepest != nullptr; deepest = deepest->up) {
+		deepest->descendants += n;
+		deepest->stamp++;
+		if (n < made) n++;
+	}
+}
 
-		if (i+1 == keys.size()) {
-			/* */ long bean_id = f->second.getOneID();
-			auto target = f->second.son_of.find(prev_iter->id);
+/* node as the newest son of parent, with the link id: chained to its brothers, counted and indexed in parent.
+   Not journaled, nor counted in the subtrees of the ancestors */
+Iter*
+Database::attach (Iter* parent, map<string, Bean>::iterator node, long id) {
+	Iter& son = node->second.son_of.insert({parent->id, Iter(id)}).first->second;
+	son.prev = parent->last; // the older brother of this son is the last son before this one
+	if (parent->last != HEND) 
+		getAssociatedIter(parent->last, parent->id).next = node; // the last son (if exists) has this one as the smaller brother
+	parent->last = node; // this is the new son
+	son.up = parent;
+	parent->sons++;
+	
+	auto sorted = sorted_sons.find(parent->id);
+	if (sorted != sorted_sons.end()) sorted->second.insert(node);
+	auto numeric = numeric_sons.find(parent->id);
+	double value;
+	if (numeric != numeric_sons.end() and Utils::toNumber(node->first, value)) numeric->second.emplace(value, node);
+	return &son;
+}
 
-			if (target != f->second.son_of.end()) { // if node to delete exists
-				waterfall_delete(target->second, amt);
-				
-				if (prev_iter->last == f)
-					prev_iter->last = target->second.prev; //'.next' - bug solved ??
-				if (target->second.prev != HEND)
-					getAssociatedIter(target->second.prev, prev_iter->id).next = target->second.next;
-				if (target->second.next != HEND)
-					getAssociatedIter(target->second.next, prev_iter->id).prev = target->second.prev;
-
-				f->second.son_of.erase(prev_iter->id); /* the node is no more child of prev_iter */
-				amt++;
-				/* */ reg(true, {OP__DEL_MA, to_string(bean_id), to_string(prev_iter->id)});
-				
-				if (!toupdate.empty() and !keys.empty()) { // snippet for the upd_
-					vector<string> keys2(keys.begin(), keys.end()-1);
-					keys2.insert(keys2.end(), toupdate.begin(), toupdate.end());
-					set_(keys2);
-				}
+/* literal steps and alternatives are created, the selectors (*, **, pre*) run over the existing nodes only */
+void 
+Database::set__ (const PathPattern& p, size_t i, Iter* prev_iter, vector<string>& path, int& amt, bool created) {
+	size_t depth = path.size();
+	for (; i < p.steps.size(); i++) {
+		auto& s = p.steps[i];
+		
+		if (s.kind == PathPattern::ONE_OF) { // each alternative
+			for (auto& alt : s.tokens) {
+				bool c = created;
+				Iter* at = link(prev_iter, alt, amt, c);
+				path.push_back(alt);
+				set__(p, i + 1, at, path, amt, c);
+				path.pop_back();
 			}
-			
-			bool empty_node = f->second.son_of.empty();
-			/* */ reg(empty_node, {OP__DEL_NO, to_string(bean_id)});
-			if (empty_node) heap.erase(f);
+			path.resize(depth);
 			return;
 		}
-
-		prev_iter = &f->second.son_of.at(prev_iter->id);
+		
+		if (p.selector(i)) { // up to the last selector, then the rest under each node found
+			size_t last = i;
+			for (size_t j = i; j < p.steps.size(); j++) if (p.selector(j)) last = j;
+			if (created) notify("SET", path, {});
+			vector<pair<Iter*, vector<string>>> found;
+			match(p, i, last + 1, prev_iter, [&found](vector<MatchFrame>& stack) {
+				found.push_back({stack.back().cur, matchPath(stack)});
+			});
+			for (auto& f : found) {
+				vector<string> subpath = path;
+				subpath.insert(subpath.end(), f.second.begin(), f.second.end());
+				set__(p, last + 1, f.first, subpath, amt, false);
+			}
+			path.resize(depth);
+			return;
+		}
+		
+		path.push_back(s.tokens[0]);
+		prev_iter = link(prev_iter, s.tokens[0], amt, created);
 	}
+	if (created) notify("SET", path, {});
+	path.resize(depth);
 }
 
-int 
-Database::del_ (vector<string> keys) {
+
+int
+Database::set_ (vector<string> keys) {
 	int amt = 0;
-	del__(keys, 0, &root, amt, false, {});
+	vector<string> path;
+	set__(PathPattern(keys), 0, base, path, amt, false);
 	return amt;
 }
 
-int 
-Database::drop_() {
-	heap.clear();
-	root.last = HEND;
-	reg(true, {OP__DROPDB});
-	return 0;
-}	
-
 
-vector<map<string, Bean>::iterator>
-Database::getSons_ (Iter parent_iter) {
-	vector<map<string, Bean>::iterator> results;
+const long RECLAIM__STEP = 4096; // links or nodes freed per lock taken by the reclaimer
+const long RECLAIM__PAUSE_US = 200; // between the steps, for the commands waiting on the lock
 
-	map<string, Bean>::iterator	it = parent_iter.last;
-	while (it != HEND) {
-		results.push_back(it);
-		it = it->second.son_of.at(parent_iter.id).prev;
+/* frees up to budget links (of the cut subtrees, from the top: a son at a time, so the cost of a step does not depend on the
+   tree) or nodes (of the dropped heaps). False once nothing is left, and the reclaimer stops */
+bool
+Database::reclaim (long budget) {
+	lock_guard<recursive_mutex> lg(mtx_heap);
+	while (budget > 0 and !dropped.empty()) {
+		auto& h = dropped.back();
+		for (; budget > 0 and !h.empty(); budget--, backlog--) h.erase(h.begin());
+		if (h.empty()) dropped.pop_back();
 	}
-
-	return results;
+	
+	for (; budget > 0 and !graveyard.empty(); budget--) {
+		Iter& dead = graveyard.back().mapped();
+		if (dead.last == HEND) { // no sons left
+			sorted_sons.erase(dead.id);
+			numeric_sons.erase(dead.id);
+			expiring.erase(dead.id);
+			graveyard.pop_back();
+			backlog--;
+			continue;
+		}
+		auto son = dead.last;
+		auto link = son->second.son_of.find(dead.id);
+		dead.last = link->second.prev;
+		graveyard.push_back(son->second.son_of.extract(link));
+		if (son->second.son_of.empty()) heap.erase(son); // no link left to reach it
+	}
+	
+	if (graveyard.empty() and dropped.empty()) reclaiming = false;
+	return reclaiming;
 }
 
-map<string, bool>
-Database::getSons (Iter parent_iter) {
-	vector<map<string, Bean>::iterator> results = getSons_(parent_iter);
-	map<string,bool> sresults;
-	for (auto& i : results)
-		sresults[i->first];
-	return sresults;
+/* the reclaimer, if not already running: steps until nothing is left */
+void
+Database::reclaimLater() {
+	if (reclaiming) return;
+	reclaiming = true;
+	thread([this]() {
+		while (reclaim(RECLAIM__STEP)) this_thread::sleep_for(chrono::microseconds(RECLAIM__PAUSE_US));
+	}).detach();
 }
 
-Iter aborted1(-1);
-Iter aborted2(-2);
+const long EXPIRE__BATCH = 1024; // links deleted per lock taken by the ticker
+const long EXPIRE__PAUSE_US = 200; // between the batches, while more links are due
+const long EXPIRE__TICK_MS = 100; // between the looks at the wheel, otherwise
 
-void
-Database::get__ (vector<string> keys, vector<Iter>& prev_ids_results, Iter prev_iter, int spanner, bool nowildcard) {
-	for (int i=spanner; i<keys.size(); i++) {
-		auto& k = keys[i];
+/* the links due, up to budget of them, deleted as DEL does and journaled as one OP__EXPIRED record (more: some are still due).
+   A link in a subtree deleted meanwhile is skipped (no up link leads to the root). False once no deadline is left, and the ticker stops */
+bool
+Database::expire (long budget, bool& more) {
+	lock_guard<recursive_mutex> lg(mtx_heap);
+	wheel.advance(Utils::getTimestampMs(), due);
+	vector<string> record = {OP__EXPIRED};
+	map<Iter*, vector<string>> paths; // of the parents, for the events
+	int amt = 0;
+	for (; budget > 0 and !due.empty(); due.pop_front()) {
+		auto [id, deadline] = due.front();
+		auto e = expiring.find(id);
+		if (e == expiring.end() or e->second.deadline != deadline) continue; // deleted, or given another deadline
+		Expiring x = e->second;
+		expiring.erase(e);
+		Iter* a = x.link;
+		while (a != nullptr and a != &root) a = a->up;
+		if (a == nullptr) continue;
 		
-		if (k == "*" and !nowildcard) {
-			map<string,bool> uncles = getSons(prev_iter);
-			for (auto& u : uncles) {
-				k = u.first;
-				get__(keys, prev_ids_results, prev_iter, i, true);
-			}
-			return;
+		budget--;
+		if (!WATCHERS.empty()) {
+			vector<string> path = pathOf(x.link->up, paths);
+			path.push_back(x.node->first);
+			notify("DEL", path, {});
 		}
-		if (!nowildcard) k = Utils::replaceAll(k, "\\*", "*");
-		nowildcard = false;
+		unlink(x.link->up, x.node, amt, false);
+		record.push_back(to_string(id));
+	}
+	if (record.size() > 1) reg(true, record);
+	commit();
+	publish();
+	
+	more = !due.empty();
+	if (expiring.empty()) { // the timers left are of deleted links
+		wheel.clear();
+		due.clear();
+		ticking = false;
+	}
+	return ticking;
+}
 
-		auto f = heap.find(k);
+/* the ticker, if not already running: a step as soon as the previous one if links are still due, otherwise at each tick */
+void
+Database::expireLater() {
+	if (ticking) return;
+	ticking = true;
+	thread([this]() {
+		bool more = false;
+		while (expire(EXPIRE__BATCH, more))
+			this_thread::sleep_for(more ? chrono::microseconds(EXPIRE__PAUSE_US) : chrono::microseconds(EXPIRE__TICK_MS * 1000));
+	}).detach();
+}
 
-		if (f == heap.end()) {
-			prev_iter = aborted1; // aborted
-			break;
-		}
-		
-		auto fs = f->second.son_of.find(prev_iter.id);
-		if (fs == f->second.son_of.end()) {
-			prev_iter = aborted2; // aborted
-			break;
-		}
-		
-		prev_iter = fs->second;
+/* the path of a link from the root: the token of each ancestor looked for among the sons of its parent, once per batch
+   (known: the links already found) */
+vector<string>
+Database::pathOf (Iter* link, map<Iter*, vector<string>>& known) {
+	vector<Iter*> chain; // up to the root, or to a link known
+	Iter* a = link;
+	for (; a != &root and !known.count(a); a = a->up) chain.push_back(a);
+	vector<string> path = a == &root ? vector<string>() : known[a];
+	for (auto c = chain.rbegin(); c != chain.rend(); c++) {
+		Iter* parent = (*c)->up;
+		for (auto s = parent->last; s != HEND; s = getAssociatedIter(s, parent->id).prev)
+			if (&getAssociatedIter(s, parent->id) == *c) {
+				path.push_back(s->first);
+				break;
+			}
+		known[*c] = path;
 	}
-		
-	prev_ids_results.push_back(prev_iter);
+	return path;
 }
 
-pair<vector<string>, int> 
-Database::get_ (vector<string> keys) {
-	vector<Iter> prev_ids_results;
-	get__(keys, prev_ids_results, root, 0, false);
+/* EXPIRE, SET : EX: the nodes matching the path are deleted once the seconds have passed (0: the deadline dropped). The deadline
+   is of the link, so it follows the node through MOVE, RENAME and UPD, and a new one replaces it (the old timer is skipped when
+   due); the ticker looks at the wheel every EXPIRE__TICK_MS. Journaled as an OP__EXPIRE record per node. Returns the nodes */
+long
+Database::expire_ (vector<string> keys, long seconds) {
+	PathPattern p(keys);
+	if (p.steps.empty()) return 0;
+	vector<pair<Iter*, map<string, Bean>::iterator>> targets;
+	match(p, 0, p.steps.size(), base, [&targets](vector<MatchFrame>& stack) {
+		if (stack.back().node != HEND) targets.push_back({stack.back().cur, stack.back().node});
+	});
 	
-	map<string, bool> mresults;
-	int n_aborted = 0; // 0 -> no elements below, -1 -> aborted
-	for (auto& i : prev_ids_results) {
-		if (i.id < 0) {n_aborted++; continue;}
-		map<string,bool> els = getSons(i);
-		// results.insert(results.end(), els.begin(), els.end());
-		mresults.insert(els.begin(), els.end());
+	long now = Utils::getTimestampMs();
+	long deadline = seconds > 0 ? now + seconds * 1000 : 0;
+	wheel.advance(now, due);
+	for (auto& [link, node] : targets) {
+		if (deadline > 0) {
+			expiring[link->id] = {link, node, deadline};
+			wheel.add(link->id, deadline);
+		}
+		else expiring.erase(link->id);
+		reg(true, {OP__EXPIRE, to_string(link->id), to_string(deadline)});
 	}
+	if (!expiring.empty()) expireLater();
+	return targets.size();
+}
 
-	vector<string> results;
-	for (auto& i : mresults) results.push_back(i.first); // use map as result and put in utils getKeys of map TODO
+/* TTL: the seconds left to the node of a literal path, -1 if it has no deadline, -2 if missing */
+long
+Database::ttl_ (vector<string> keys) {
+	if (!PathPattern(keys).literal()) return -2;
+	for (auto& k : keys) k = PathPattern::unescape(k);
+	Iter* parent;
+	map<string, Bean>::iterator node;
+	Iter* found = locate(keys, parent, node);
+	if (found == nullptr) return -2;
+	auto e = expiring.find(found->id);
+	if (e == expiring.end()) return -1;
+	return max(0L, (e->second.deadline - Utils::getTimestampMs() + 999) / 1000);
+}
 
-	// for (auto& r : results) r = deencode(r);
+/* the node is no more son of parent: its link is cut from the tree with the subtree in it, left to the reclaimer.
+   Journaled as one OP__DEL_MA (unless by the ticker), at replay the links below are left unreachable and dropped at the end of the load */
+void
+Database::unlink (Iter* parent, map<string, Bean>::iterator f, int& amt, bool journaled) {
+	/* */ long bean_id = f->second.getOneID();
+	auto target = f->second.son_of.find(parent->id);
+	
+	if (target != f->second.son_of.end()) { // if node to delete exists
+		if (parent->last == f)
+			parent->last = target->second.prev; //'.next' - bug solved ??
+		if (target->second.prev != HEND)
+			getAssociatedIter(target->second.prev, parent->id).next = target->second.next;
+		if (target->second.next != HEND)
+			getAssociatedIter(target->second.next, parent->id).prev = target->second.prev;
+		parent->sons--;
+		grow(parent, -1 - target->second.descendants);
+
+		auto sorted = sorted_sons.find(parent->id);
+		if (sorted != sorted_sons.end()) sorted->second.erase(f);
+		auto numeric = numeric_sons.find(parent->id);
+		double value;
+		if (numeric != numeric_sons.end() and Utils::toNumber(f->first, value)) numeric->second.erase(make_pair(value, f));
+		amt++;
+		/* */ reg(journaled, {OP__DEL_MA, to_string(bean_id), to_string(parent->id)});
+		backlog += 1 + target->second.descendants;
+		detach(target->second.id);
+		graveyard.push_back(f->second.son_of.extract(target));
+		graveyard.back().mapped().up = nullptr; // no more reachable from the root, nor the links below it
+		reclaimLater();
+	}
+	
+	if (f->second.son_of.empty()) heap.erase(f);
+}
 
-	return make_pair(results, 
-		prev_ids_results.size() == 1 && n_aborted > 0 ? -1 : results.size()
-	); // TODO flag
+/* the link of node under parent goes, with its subtree, under dest as token. The Iter itself is handed over (a map node moved
+   between the son_of maps): its id, so the links of its sons, and its counters stay as they are; only the brothers around it,
+   the counters of the ancestors and the indexes of the two parents change. Brothers are chained by id, so under another parent
+   it takes its place among them from the newest (none to pass for a new parent). Journaled as one OP__MOVE.
+   False if token is already a son of dest, or dest is within the subtree */
+bool
+Database::relink (Iter* parent, map<string, Bean>::iterator node, Iter* dest, const string& token) {
+	Iter* moved = &node->second.son_of.at(parent->id);
+	for (Iter* a = dest; a != nullptr; a = a->up)
+		if (a == moved) return false;
+	auto target = heap.try_emplace(token).first;
+	if (target->second.son_of.count(dest->id)) return false; // also itself, unchanged
+	
+	auto older = moved->prev, younger = moved->next; // its place, if it stays under the same parent
+	detach(moved->id);
+	if (parent->last == node) parent->last = moved->prev;
+	if (moved->prev != HEND) getAssociatedIter(moved->prev, parent->id).next = moved->next;
+	if (moved->next != HEND) getAssociatedIter(moved->next, parent->id).prev = moved->prev;
+	parent->sons--;
+	grow(parent, -1 - moved->descendants);
+	auto sorted = sorted_sons.find(parent->id);
+	if (sorted != sorted_sons.end()) sorted->second.erase(node);
+	auto numeric = numeric_sons.find(parent->id);
+	double value;
+	if (numeric != numeric_sons.end() and Utils::toNumber(node->first, value)) numeric->second.erase(make_pair(value, node));
+	
+	auto handle = node->second.son_of.extract(parent->id);
+	handle.key() = dest->id;
+	moved = &target->second.son_of.insert(move(handle)).position->second; // the same Iter
+	auto timed = expiring.find(moved->id);
+	if (timed != expiring.end()) timed->second.node = target;
+	
+	if (dest != parent) {
+		younger = HEND;
+		older = dest->last;
+		while (older != HEND and getAssociatedIter(older, dest->id).id > moved->id) {
+			younger = older;
+			older = getAssociatedIter(older, dest->id).prev;
+		}
+	}
+	moved->prev = older;
+	moved->next = younger;
+	if (older != HEND) getAssociatedIter(older, dest->id).next = target;
+	if (younger != HEND) getAssociatedIter(younger, dest->id).prev = target;
+	else dest->last = target;
+	moved->up = dest;
+	dest->sons++;
+	grow(dest, 1 + moved->descendants);
+	sorted = sorted_sons.find(dest->id);
+	if (sorted != sorted_sons.end()) sorted->second.insert(target);
+	numeric = numeric_sons.find(dest->id);
+	if (numeric != numeric_sons.end() and Utils::toNumber(token, value)) numeric->second.emplace(value, target);
+	
+	if (node->second.son_of.empty()) heap.erase(node);
+	/* */ reg(true, {OP__MOVE, to_string(moved->id), to_string(dest->id), token});
+	return true;
 }
 
-int 
-Database::is_ (vector<string> keys) {
-	vector<Iter> prev_ids_results;
-	get__(keys, prev_ids_results, root, 0, false);
-	for (auto& i : prev_ids_results)
-		if (i.id < 0) return 0;
-	return 1;
+/* the link of a literal path (from the base, or from), with its parent and node; nullptr if missing */
+Iter*
+Database::locate (const vector<string>& keys, Iter*& parent, map<string, Bean>::iterator& node, Iter* from) {
+	Iter* cur = from != nullptr ? from : base;
+	parent = nullptr;
+	node = HEND;
+	for (auto& k : keys) {
+		auto b = heap.find(k);
+		if (b == heap.end()) return nullptr;
+		auto l = b->second.son_of.find(cur->id);
+		if (l == b->second.son_of.end()) return nullptr;
+		parent = cur;
+		node = b;
+		cur = &l->second;
+	}
+	return cur;
 }
 
-int
-Database::count_ (vector<string> keys) {
-	return get_(keys).second;
+/* COPY: the subtree of a literal path at another literal path (its parents created if missing), whose last node is the token
+   of the copy. The copy shares the nodes (tokens) of the source and only adds links: one per node, in one pass, the counters of
+   each copied link taken from its source. The new links get consecutive ids from the first one, depth first and brothers oldest
+   first, so the whole copy is journaled as one OP__COPY (only the links older than the first id are the source, also when the
+   destination is within it). Returns the nodes copied, 0 if the destination is taken, -1 for a missing source or a wildcard */
+long
+Database::copy_ (vector<string> from, vector<string> to) {
+	if (from.empty() or to.empty() or !PathPattern(from).literal() or !PathPattern(to).literal()) return -1;
+	Iter* parent;
+	map<string, Bean>::iterator node;
+	Iter* source = locate(from, parent, node);
+	if (source == nullptr) return -1;
+	
+	begin();
+	Iter* dest = base;
+	int links = 0;
+	bool created = false;
+	for (size_t k = 0; k + 1 < to.size(); k++)
+		dest = link(dest, PathPattern::unescape(to[k]), links, created);
+	string token = PathPattern::unescape(to.back());
+	auto target = heap.try_emplace(token).first;
+	if (target->second.son_of.count(dest->id)) {
+		end();
+		return 0;
+	}
+	
+	struct Copy {
+		Iter* source;
+		Iter* parent; // of the copy
+		map<string, Bean>::iterator node;
+	};
+	long first = uuid.see() + 1;
+	long copied = 0;
+	vector<Copy> stack = {{source, dest, target}};
+	while (!stack.empty()) {
+		Copy c = stack.back();
+		stack.pop_back();
+		Iter* made = attach(c.parent, c.node, uuid.get());
+		made->descendants = c.source->descendants;
+		copied++;
+		for (auto s = c.source->last; s != HEND; s = getAssociatedIter(s, c.source->id).prev) { // the oldest on top
+			Iter& son = getAssociatedIter(s, c.source->id);
+			if (son.id < first) stack.push_back({&son, made, s});
+		}
+	}
+	grow(dest, copied);
+	
+	/* */ reg(true, {OP__COPY, to_string(source->id), to_string(dest->id), token, to_string(first)});
+	end();
+	for (auto& k : to) k = PathPattern::unescape(k);
+	notify("SET", to, {});
+	return copied;
 }
 
-//int // TODO
-//Database::put_ (vector<string> keys) { // TODO check procedure correctness !
-//	int amt = 0;
-//
-//	vector<string> keys_except_last = keys;
-//	if (!keys_except_last.empty()) keys_except_last.pop_back();
-//	
-//	auto e = get_(keys_except_last);
-//	if (e.first.size() != e.second) {
-//		return amt;
-//	}
-//
-//	return set_(keys);
-//}
+const size_t HANDLES__MAX = 1 << 16; // links resolved to handles kept per database, the least recently used forgotten first
+const size_t DETACHED__MAX = 1 << 16; // cut or moved links logged for the handles, a handle not checked since the oldest is refused
 
-int
-Database::upd_ (vector<string> keys, vector<string> new_nodes) {
-	int amt = 0;
-	del__(keys, 0, &root, amt, false, new_nodes);
-	return 0; // TODO return the right amt
+/* a new generation, for the link cut or moved at it */
+void
+Database::detach (long link_id) {
+	detached.emplace_back(++generation, link_id);
+	if (detached.size() > DETACHED__MAX) {
+		detached_from = detached.front().first;
+		detached.pop_front();
+	}
 }
 
-//int
-//Database::ups_ (vector<string> keys, vector<string> new_nodes) { //upsert TODO
-//	
-//}
+/* none of the links cut or moved since the handle was last checked is in its chain, so the link kept is still at its path.
+   False as well if the log no longer goes back to that check */
+bool
+Database::intact (Handle& h) {
+	if (h.checked == generation) return true;
+	if (h.checked < detached_from) return false;
+	auto d = upper_bound(detached.begin(), detached.end(), make_pair(h.checked, numeric_limits<long>::max()));
+	for (; d != detached.end(); d++)
+		if (binary_search(h.chain.begin(), h.chain.end(), d->second)) return false;
+	h.checked = generation;
+	return true;
+}
 
-string 
-Database::tree_ (vector<string> keys, string indexer) {
-	stringstream ss("");
+/* RESOLVE: the handle of the link of a literal path, @id.generation, for the next commands to start from it
+   instead of walking the path again (rebase()). The handle already kept for the link stays if intact, with its generation,
+   otherwise the link is kept anew with the ids of its chain, at the current generation. "" if missing or a wildcard */
+string
+Database::resolve_ (vector<string> keys) {
+	if (!PathPattern(keys).literal()) return "";
+	for (auto& k : keys) k = PathPattern::unescape(k);
+	Iter* parent;
+	map<string, Bean>::iterator node;
+	Iter* found = locate(keys, parent, node);
+	if (found == nullptr) return "";
+	
+	auto f = handles.find(found->id);
+	if (f != handles.end()) {
+		handles_used.splice(handles_used.begin(), handles_used, f->second.used);
+		if (intact(f->second)) return "@" + to_string(found->id) + "." + to_string(f->second.since);
+	}
+	else {
+		if (handles.size() >= HANDLES__MAX) {
+			handles.erase(handles_used.back());
+			handles_used.pop_back();
+		}
+		handles_used.push_front(found->id);
+		f = handles.emplace(found->id, Handle{}).first;
+		f->second.used = handles_used.begin();
+	}
+	Handle& h = f->second;
+	h.link = found;
+	h.path = based;
+	h.path.insert(h.path.end(), keys.begin(), keys.end());
+	h.chain.clear();
+	for (Iter* a = found; a != &root; a = a->up) h.chain.push_back(a->id);
+	sort(h.chain.begin(), h.chain.end());
+	h.since = h.checked = generation;
+	return "@" + to_string(found->id) + "." + to_string(generation);
+}
+
+/* the paths of the running command start from the link of the handle ("": from the root). The link kept is used as it is
+   while neither it nor a link above it has been cut or moved since the generation of the handle; the cuts and moves elsewhere
+   only cost a look at the log. False if the handle is unknown, of another generation than the one kept, or its node deleted or
+   moved (RESOLVE again) */
+bool
+Database::rebase (const string& handle) {
+	base = &root;
+	based.clear();
+	if (handle.empty()) return true;
+	
+	size_t dot = handle.find('.');
+	auto h = handles.find(stol(handle.substr(1, dot - 1)));
+	if (h == handles.end() or handle.substr(dot + 1) != to_string(h->second.since)) return false;
+	if (!intact(h->second)) {
+		handles_used.erase(h->second.used);
+		handles.erase(h);
+		return false;
+	}
+	handles_used.splice(handles_used.begin(), handles_used, h->second.used);
+	base = h->second.link;
+	based = h->second.path;
+	return true;
+}
+
+/* deletes every node matching the path (the deepest first, so no match is inside an already deleted one) */
+int
+Database::del__ (const PathPattern& p) {
+	int amt = 0;
+	if (p.steps.empty()) return amt;
+	
+	struct Target {
+		Iter* parent;
+		map<string, Bean>::iterator node;
+		vector<string> path;
+	};
+	vector<Target> targets;
+	match(p, 0, p.steps.size(), base, [&targets](vector<MatchFrame>& stack) {
+		if (stack.back().node != HEND) // not the root (e.g. DEL **)
+			targets.push_back({stack.back().parent, stack.back().node, matchPath(stack)});
+	});
+	stable_sort(targets.begin(), targets.end(), [](const Target& a, const Target& b) { return a.path.size() > b.path.size(); });
+	
+	for (auto& t : targets) {
+		unlink(t.parent, t.node, amt);
+		notify("DEL", t.path, {});
+	}
+	return amt;
+}
+
+int 
+Database::del_ (vector<string> keys) {
+	return del__(PathPattern(keys));
+}
+
+/* LOAD: the paths sorted and deduplicated, then created in one pass, each one from the nodes it shares with the previous one.
+   The tokens are put in the heap first, sorted, each next to the previous one; journaled as one atomic unit, written at once by commit() */
+long
+Database::bulk_ (vector<vector<string>>& paths) {
+	sort(paths.begin(), paths.end());
+	paths.erase(unique(paths.begin(), paths.end()), paths.end());
+	
+	vector<size_t> from(paths.size()); // first token not shared with the previous path
+	vector<size_t> slot(paths.size() + 1); // of the path in nodes
+	for (size_t r = 0; r < paths.size(); r++) {
+		size_t common = 0;
+		if (r > 0)
+			while (common < paths[r].size() and common < paths[r-1].size() and paths[r][common] == paths[r-1][common]) common++;
+		from[r] = common;
+		slot[r+1] = slot[r] + paths[r].size() - common;
+	}
+	
+	vector<map<string, Bean>::iterator> nodes(slot.back());
+	vector<pair<const string*, size_t>> tokens; // x slot
+	tokens.reserve(nodes.size());
+	for (size_t r = 0; r < paths.size(); r++)
+		for (size_t i = from[r]; i < paths[r].size(); i++)
+			tokens.push_back({&paths[r][i], slot[r] + i - from[r]});
+	sort(tokens.begin(), tokens.end(), [](auto& a, auto& b) { return *a.first < *b.first; });
+	auto hint = heap.end();
+	for (size_t t = 0; t < tokens.size(); t++) {
+		if (t > 0 and *tokens[t].first == *tokens[t-1].first) {
+			nodes[tokens[t].second] = nodes[tokens[t-1].second];
+			continue;
+		}
+		auto it = heap.try_emplace(hint, *tokens[t].first);
+		nodes[tokens[t].second] = it;
+		hint = next(it);
+	}
+	
+	int amt = 0;
+	vector<Iter*> stack = {&root}; // the links of the previous path
+	begin();
+	for (size_t r = 0; r < paths.size(); r++) {
+		stack.resize(from[r] + 1);
+		bool created = false;
+		int made = amt;
+		for (size_t i = from[r]; i < paths[r].size(); i++)
+			stack.push_back(link(stack.back(), nodes[slot[r] + i - from[r]], amt, created, false));
+		if (amt > made) settle(stack.back(), amt - made);
+		if (created) notify("SET", paths[r], {});
+	}
+	end();
+	return amt;
+}
+
+int 
+Database::drop_() {
+	graveyard.clear(); // their links are in the heap, freed with it
+	dropped.push_back(move(heap));
+	heap.clear();
+	backlog = 0;
+	for (auto& h : dropped) backlog += h.size();
+	reclaimLater();
+	sorted_sons.clear();
+	numeric_sons.clear();
+	root.last = HEND;
+	root.sons = root.descendants = 0;
+	handles.clear();
+	handles_used.clear();
+	generation++;
+	detached.clear();
+	detached_from = generation;
+	expiring.clear();
+	wheel.clear();
+	due.clear();
+	cache.clear();
+	cached.clear();
+	cache_bytes = 0;
+	reg(true, {OP__DROPDB});
+	notify("DROP", {}, {});
+	return 0;
+}	
+
+
+WorkPool POOL; // --pool: the threads a query can split its work over, the caller included
+const size_t GET__FANOUT = 4096; // sons a * or pre* walks, or nodes GET merges, before the work is split over the pool
+const size_t GET__CHUNK = 1024; // of them per task: more tasks than threads, for the workers to steal the uneven ones
+
+/* the links matching the pattern, in the order of match(). The sons of a large fan-out (the first * or pre* step)
+   are matched in chunks on the pool against the rest of the pattern, the chunks then joined in order */
+int
+Database::get__ (const PathPattern& p, vector<Iter>& results) {
+	size_t fan = 0;
+	while (fan < p.steps.size() and !p.selector(fan)) fan++;
+	if (POOL.size() == 1 or fan + 1 >= p.steps.size() or p.steps[fan].kind == PathPattern::DEEP or p.deeps > 1)
+		return match(p, 0, p.steps.size(), base, [&results](vector<MatchFrame>& stack) {
+			results.push_back(*stack.back().cur);
+		});
+	
+	vector<Iter*> parents;
+	int misses = match(p, 0, fan, base, [&parents](vector<MatchFrame>& stack) {
+		parents.push_back(stack.back().cur);
+	});
+	const PathPattern::Step& s = p.steps[fan];
+	for (Iter* parent : parents) {
+		vector<Iter*> sons; // newest first, as match() walks them
+		for (auto it = parent->last; it != HEND; ) {
+			Iter& link = getAssociatedIter(it, parent->id);
+			if (s.kind != PathPattern::PREFIX or it->first.compare(0, s.tokens[0].size(), s.tokens[0]) == 0) sons.push_back(&link);
+			it = link.prev;
+		}
+		
+		size_t tasks = (sons.size() + GET__CHUNK - 1) / GET__CHUNK;
+		vector<vector<Iter>> found(tasks);
+		vector<int> missed(tasks, 0);
+		auto chunk = [&](size_t t) {
+			for (size_t k = t * GET__CHUNK; k < sons.size() and k < (t + 1) * GET__CHUNK; k++)
+				missed[t] += match(p, fan + 1, p.steps.size(), sons[k], [&found, t](vector<MatchFrame>& stack) {
+					found[t].push_back(*stack.back().cur);
+				});
+		};
+		if (sons.size() < GET__FANOUT) for (size_t t = 0; t < tasks; t++) chunk(t);
+		else POOL.run(tasks, chunk); // the caller holds the lock: a still tree for all
+		
+		for (size_t t = 0; t < tasks; t++) {
+			misses += missed[t];
+			results.insert(results.end(), found[t].begin(), found[t].end());
+		}
+	}
+	return misses;
+}
+
+/* the sons of the links, sorted and once each, as the keys of a map: each chunk of links sorts its own on the pool,
+   the sorted runs are then merged two by two. A token is one node of the heap, so the duplicates share the address */
+void
+Database::mergeSons (vector<Iter>& links, vector<string>& out) {
+	size_t tasks = (links.size() + GET__CHUNK - 1) / GET__CHUNK;
+	vector<vector<const string*>> runs(tasks);
+	auto before = [](const string* a, const string* b) { return *a < *b; };
+	POOL.run(tasks, [&](size_t t) {
+		vector<const string*>& run = runs[t];
+		for (size_t k = t * GET__CHUNK; k < links.size() and k < (t + 1) * GET__CHUNK; k++)
+			for (auto it = links[k].last; it != HEND; it = getAssociatedIter(it, links[k].id).prev)
+				run.push_back(&it->first);
+		sort(run.begin(), run.end(), before);
+		run.erase(unique(run.begin(), run.end()), run.end());
+	});
+	for (size_t width = 1; width < tasks; width *= 2)
+		POOL.run((tasks + 2 * width - 1) / (2 * width), [&](size_t t) {
+			size_t a = 2 * width * t, b = a + width;
+			if (b >= tasks) return;
+			vector<const string*> merged;
+			merged.reserve(runs[a].size() + runs[b].size());
+			merge(runs[a].begin(), runs[a].end(), runs[b].begin(), runs[b].end(), back_inserter(merged), before);
+			merged.erase(unique(merged.begin(), merged.end()), merged.end());
+			runs[a].swap(merged);
+			vector<const string*>().swap(runs[b]);
+		});
+	if (tasks > 0) for (auto t : runs[0]) out.push_back(*t);
+}
+
+pair<vector<string>, int> 
+Database::get_ (vector<string> keys) {
+	PathPattern p(keys);
+	vector<Iter> prev_ids_results;
+	int misses = get__(p, prev_ids_results);
+	
+	vector<string> results;
+	if (POOL.size() > 1 and prev_ids_results.size() >= GET__FANOUT) mergeSons(prev_ids_results, results);
+	else {
+		map<string, bool> mresults;
+		for (auto& i : prev_ids_results) {
+			for (auto it = i.last; it != HEND; it = getAssociatedIter(it, i.id).prev)
+				mresults[it->first];
+		}
+		for (auto& i : mresults) results.push_back(i.first); // use map as result and put in utils getKeys of map TODO
+	}
+
+	// for (auto& r : results) r = deencode(r);
+
+	return make_pair(results, 
+		p.literal() && misses > 0 ? -1 : results.size()
+	); // TODO flag
+}
+
+Database::SortedSons&
+Database::sortedSons (Iter& parent) {
+	auto f = sorted_sons.find(parent.id);
+	if (f != sorted_sons.end()) return f->second;
+	
+	SortedSons& sons = sorted_sons[parent.id];
+	for (auto it = parent.last; it != HEND; it = getAssociatedIter(it, parent.id).prev)
+		sons.insert(it);
+	return sons;
+}
+
+Database::NumericSons&
+Database::numericSons (Iter& parent) {
+	auto f = numeric_sons.find(parent.id);
+	if (f != numeric_sons.end()) return f->second;
+	
+	NumericSons& sons = numeric_sons[parent.id];
+	double value;
+	for (auto it = parent.last; it != HEND; it = getAssociatedIter(it, parent.id).prev)
+		if (Utils::toNumber(it->first, value)) sons.emplace(value, it);
+	return sons;
+}
+
+/* the first limit sons of parent within the value bounds, in the order asked */
+void 
+Database::numericGet (Iter& parent, const SonsFilter& filter, size_t limit, vector<pair<double, string>>& out) {
+	NumericSons& sons = numericSons(parent);
+	size_t n = 0;
+	if (!filter.desc) {
+		auto it = filter.minOpen ? sons.upper_bound(filter.min) : sons.lower_bound(filter.min);
+		for (; it != sons.end() and n < limit; it++, n++) {
+			if (filter.maxOpen ? it->first >= filter.max : it->first > filter.max) break;
+			out.emplace_back(it->first, it->second->first);
+		}
+	}
+	else {
+		auto it = make_reverse_iterator(filter.maxOpen ? sons.lower_bound(filter.max) : sons.upper_bound(filter.max));
+		for (; it != sons.rend() and n < limit; it++, n++) {
+			if (filter.minOpen ? it->first <= filter.min : it->first < filter.min) break;
+			out.emplace_back(it->first, it->second->first);
+		}
+	}
+}
+
+/* sons within the filter, from the ordered indexes of each parent: the cost follows the nodes returned, not the sons */
+pair<vector<string>, int> 
+Database::get_ (vector<string> keys, const SonsFilter& filter) {
+	size_t limit = filter.limit < 0 ? numeric_limits<size_t>::max() : filter.limit;
+	if (!filter.prefix and !filter.range and !filter.numeric) {
+		auto r = get_(keys);
+		if (r.first.size() > limit) {
+			r.first.resize(limit);
+			r.second = limit;
+		}
+		return r;
+	}
+	
+	PathPattern p(keys);
+	vector<Iter> parents;
+	int misses = get__(p, parents);
+	
+	vector<string> results;
+	if (filter.numeric) {
+		vector<pair<double, string>> hits;
+		for (auto& parent : parents)
+			numericGet(parent, filter, limit, hits);
+		if (parents.size() > 1) { // more parents: merged, each one already gave its first limit
+			if (filter.desc) sort(hits.begin(), hits.end(), greater<pair<double, string>>());
+			else sort(hits.begin(), hits.end());
+			hits.erase(unique(hits.begin(), hits.end()), hits.end());
+			if (hits.size() > limit) hits.resize(limit);
+		}
+		for (auto& i : hits) results.push_back(move(i.second));
+	}
+	else {
+		map<string, bool> mresults; // more parents: union
+		for (auto& parent : parents) {
+			SortedSons& sons = sortedSons(parent);
+			size_t n = 0;
+			for (auto it = sons.lower_bound(filter.lo); it != sons.end() and n < limit; it++, n++) {
+				const string& t = (*it)->first;
+				if (filter.prefix ? t.compare(0, filter.lo.size(), filter.lo) != 0 : t > filter.hi) break;
+				if (parents.size() == 1) results.push_back(t);
+				else mresults[t];
+			}
+		}
+		for (auto& i : mresults) {
+			if (results.size() == limit) break;
+			results.push_back(i.first);
+		}
+	}
+	
+	return make_pair(results, p.literal() && misses > 0 ? -1 : results.size());
+}
+
+/* MGET: the sons of each path, as get_. The literal paths share the resolution of their common prefixes */
+void
+Database::mget_ (const vector<vector<string>>& paths, vector<pair<vector<string>, int>>& out) {
+	struct Resolved {
+		Iter* link; // nullptr: missing
+		map<string, Resolved> sons;
+	};
+	Resolved top{&root, {}};
+	
+	for (auto& keys : paths) {
+		PathPattern p(keys);
+		if (!p.literal()) {
+			out.push_back(get_(keys));
+			continue;
+		}
+		
+		Resolved* r = &top;
+		for (size_t i = 0; i < p.steps.size() and r->link != nullptr; i++) {
+			const string& t = p.steps[i].tokens[0];
+			auto f = r->sons.find(t);
+			if (f == r->sons.end()) {
+				Iter* link = nullptr;
+				auto h = heap.find(t);
+				if (h != heap.end()) {
+					auto s = h->second.son_of.find(r->link->id);
+					if (s != h->second.son_of.end()) link = &s->second;
+				}
+				f = r->sons.insert({t, Resolved{link, {}}}).first;
+			}
+			r = &f->second;
+		}
+		if (r->link == nullptr) {
+			out.push_back({{}, -1});
+			continue;
+		}
+		
+		vector<string> sons;
+		for (auto it = r->link->last; it != HEND; it = getAssociatedIter(it, r->link->id).prev)
+			sons.push_back(it->first);
+		sort(sons.begin(), sons.end());
+		int n = sons.size();
+		out.push_back({move(sons), n});
+	}
+}
+
+/* SUM, MIN, MAX or AVG of the sons of the nodes of the path that are numbers, each son of each node counted once.
+   Streamed over the matches, nothing collected; a parent with the numeric index is not parsed again.
+   Returns how many numbers, -1 if a literal path is missing */
+long 
+Database::aggregate_ (vector<string> keys, const string& fn, double& result) {
+	PathPattern p(keys);
+	long n = 0;
+	double sum = 0, min = numeric_limits<double>::infinity(), max = -min, value;
+	bool summing = fn == "SUM" or fn == "AVG";
+	
+	int misses = match(p, 0, p.steps.size(), base, [&](vector<MatchFrame>& stack) {
+		Iter& parent = *stack.back().cur;
+		auto numeric = numeric_sons.find(parent.id);
+		if (numeric != numeric_sons.end()) {
+			if (numeric->second.empty()) return;
+			n += numeric->second.size();
+			min = std::min(min, numeric->second.begin()->first);
+			max = std::max(max, numeric->second.rbegin()->first);
+			if (summing)
+				for (auto& i : numeric->second) sum += i.first;
+			return;
+		}
+		for (auto it = parent.last; it != HEND; it = getAssociatedIter(it, parent.id).prev) {
+			if (!Utils::toNumber(it->first, value)) continue;
+			n++;
+			sum += value;
+			min = std::min(min, value);
+			max = std::max(max, value);
+		}
+	});
+	if (p.literal() and misses > 0) return -1;
+	
+	result = fn == "SUM" ? sum : fn == "MIN" ? min : fn == "MAX" ? max : n > 0 ? sum / n : 0;
+	return n;
+}
+
+int 
+Database::is_ (vector<string> keys) {
+	vector<Iter> prev_ids_results;
+	return get__(PathPattern(keys), prev_ids_results) == 0 ? 1 : 0;
+}
+
+/* from the counters of the links: one node (a literal path) in O(path), deep the subtrees of all the matches.
+   More nodes merge their sons as GET does, so they are listed */
+long
+Database::count_ (vector<string> keys, bool deep) {
+	PathPattern p(keys);
+	vector<Iter> found;
+	int misses = get__(p, found);
+	if (p.literal() and misses > 0) return -1;
+	
+	if (deep) {
+		long n = 0;
+		for (auto& i : found) n += i.descendants;
+		return n;
+	}
+	if (found.size() == 1) return found[0].sons;
+	return get_(keys).second;
+}
+
+//int // TODO
+//Database::put_ (vector<string> keys) { // TODO check procedure correctness !
+//	int amt = 0;
+//
+//	vector<string> keys_except_last = keys;
+//	if (!keys_except_last.empty()) keys_except_last.pop_back();
+//	
+//	auto e = get_(keys_except_last);
+//	if (e.first.size() != e.second) {
+//		return amt;
+//	}
+//
+//	return set_(keys);
+//}
+
+/* each node matching the path is replaced by the new nodes, with its subtree: relinked under the last new node,
+   the others created between it and its parent. Returns the nodes replaced (not the ones whose new place is taken) */
+int
+Database::upd_ (vector<string> keys, vector<string> new_nodes) {
+	PathPattern p(keys);
+	int amt = 0;
+	if (p.steps.empty() or new_nodes.empty()) return amt;
+	for (auto& k : new_nodes) k = PathPattern::unescape(k);
+	
+	struct Target {
+		Iter* parent;
+		map<string, Bean>::iterator node;
+		vector<string> path;
+	};
+	vector<Target> targets;
+	match(p, 0, p.steps.size(), base, [&targets](vector<MatchFrame>& stack) {
+		if (stack.back().node != HEND)
+			targets.push_back({stack.back().parent, stack.back().node, matchPath(stack)});
+	});
+	
+	begin();
+	for (auto& t : targets) {
+		Iter* dest = t.parent;
+		int links = 0;
+		bool created = false;
+		for (size_t k = 0; k + 1 < new_nodes.size(); k++)
+			dest = link(dest, new_nodes[k], links, created);
+		if (!relink(t.parent, t.node, dest, new_nodes.back())) continue;
+		amt++;
+		notify("UPD", t.path, new_nodes);
+	}
+	end();
+	return amt;
+}
+
+/* MOVE: the node of a literal path, with its subtree, to another literal path (its parents created if missing), whose last node
+   is its new token (RENAME: the same parent). Cost of the two paths and one journal record, whatever the subtree.
+   1 moved, 0 if the destination is taken or within the subtree, -1 for a missing source or a wildcard */
+int
+Database::move_ (vector<string> from, vector<string> to) {
+	if (from.empty() or to.empty() or !PathPattern(from).literal() or !PathPattern(to).literal()) return -1;
+	Iter* parent;
+	map<string, Bean>::iterator node;
+	if (locate(from, parent, node) == nullptr) return -1;
+	if (to.size() > from.size() and equal(from.begin(), from.end(), to.begin())) return 0; // within itself, before creating anything
+	
+	begin();
+	Iter* dest = base;
+	int links = 0;
+	bool created = false;
+	for (size_t k = 0; k + 1 < to.size(); k++)
+		dest = link(dest, PathPattern::unescape(to[k]), links, created);
+	bool moved = relink(parent, node, dest, PathPattern::unescape(to.back()));
+	end();
+	if (!moved) return 0;
+	
+	for (auto& k : from) k = PathPattern::unescape(k);
+	for (auto& k : to) k = PathPattern::unescape(k);
+	notify("MOVE", from, to);
+	return 1;
+}
+
+//int
+//Database::ups_ (vector<string> keys, vector<string> new_nodes) { //upsert TODO
+//	
+//}
+
+int TREE__THREADS = 0; // --tree-threads: slices of a large TREE, serialized on the pool (0: one per thread of the pool)
+const long TREE__SLICE = 1 << 16; // nodes per thread at least: a smaller TREE is serialized by the caller alone
+
+string 
+Database::tree_ (vector<string> keys, string indexer, long depth) {
+	string s;
 	vector<Iter> nodes_to_scout;
-	get__(keys, nodes_to_scout, root, 0, false);
-	for (auto& nts : nodes_to_scout) {
-		printSons(nts, ss);
+	get__(PathPattern(keys), nodes_to_scout);
+	long threads = TREE__THREADS > 0 ? TREE__THREADS : POOL.size();
+	for (auto& nts : nodes_to_scout) { // a node per line, the sons of a node between { and }
+		if (nts.last == HEND or depth == 0) continue;
+		s += "{\n";
+		
+		/* slices of about the same nodes, in the order of the walk, each serialized by a thread from where its cut
+		   puts the stack to the cut of the next one: the pieces joined are the walk of one thread */
+		long parts = min(threads, max(1L, nts.descendants / TREE__SLICE));
+		vector<vector<WalkFrame>> cuts;
+		for (long k = 0; k < parts; k++) cuts.push_back(treeCut(nts, nts.descendants * k / parts, depth));
+		for (auto& c : cuts) if (c.empty()) parts = 1; // one thread walks all
+		cuts[0] = {{&nts, HEND, nts.last}};
+		vector<string> pieces(parts);
+		vector<Iter*> stops(parts, nullptr);
+		for (long k = 0; k + 1 < parts; k++) stops[k] = &getAssociatedIter(cuts[k+1].back().next, cuts[k+1].back().link->id);
+		POOL.run(parts, [&](size_t k) { // the caller holds the lock
+			treeSlice(cuts[k], stops[k], depth, k == 0 ? s : pieces[k]);
+		});
+		for (long k = 1; k < parts; k++) {
+			s += pieces[k];
+			string().swap(pieces[k]);
+		}
+		s += "}\n";
 	}
-	if (ss.str() == "") ss << "<empty>";
-	string s = ss.str();
-	if (!s.empty() and s.back() == '\n') s.pop_back();
+	if (s.empty()) return "<empty>";
+	s.pop_back();
 	return s;
 }
 
+/* the stack of a walk of the sons of parent about to visit the node at position at (0: the first son), in the order of the walk,
+   from the subtree counters; not deeper than depth, the node there then the ancestor of it. Empty if the counters are off */
+vector<WalkFrame>
+Database::treeCut (Iter& parent, long at, long depth) {
+	vector<WalkFrame> stack = {{&parent, HEND, parent.last}};
+	while (true) {
+		WalkFrame& f = stack.back();
+		for (; f.next != HEND; f.next = getAssociatedIter(f.next, f.link->id).prev) {
+			long nodes = getAssociatedIter(f.next, f.link->id).descendants + 1;
+			if (at < nodes) break;
+			at -= nodes;
+		}
+		if (f.next == HEND) return {}; // counters off
+		auto node = f.next;
+		Iter& link = getAssociatedIter(node, f.link->id);
+		if (at == 0 or link.last == HEND or (depth > 0 and (long)stack.size() >= depth)) return stack;
+		at--;
+		f.next = link.prev; // as walk leaves it in the sons of a node
+		stack.push_back({&link, node, link.last});
+	}
+}
+
+/* the nodes of a TREE from the stack of a cut up to the link stop (nullptr: to the end), appended to out */
+void
+Database::treeSlice (vector<WalkFrame> stack, Iter* stop, long depth, string& out) {
+	walk(stack, -1, [&out, stop, depth](vector<WalkFrame>& stack, map<string, Bean>::iterator node, Iter& link) {
+		if (&link == stop) return WALK__STOP;
+		webSerialize(out, node->first);
+		out += '\n';
+		if (link.last == HEND or (depth > 0 and (long)stack.size() >= depth)) return WALK__OVER;
+		out += "{\n";
+		return WALK__INTO;
+	}, [&out](vector<WalkFrame>&, Iter&) {
+		out += "}\n";
+	});
+}
+
+/* the son (of the parent) linked with id, if still there and inclusive, otherwise the first older one */
+map<string, Bean>::iterator
+Database::olderThan (Iter& parent, long id, const string& token, bool inclusive) {
+	auto f = heap.find(token);
+	if (f != heap.end()) {
+		auto s = f->second.son_of.find(parent.id);
+		if (s != f->second.son_of.end() and s->second.id == id)
+			return inclusive ? f : s->second.prev;
+	}
+	
+	auto it = parent.last; // gone: brothers are chained by id, newest last
+	while (it != HEND and getAssociatedIter(it, parent.id).id > id)
+		it = getAssociatedIter(it, parent.id).prev;
+	return it;
+}
+
+/* SCAN: the sons (with deep the whole subtree, depth first) of one node as depth x node, a page of count at a time, newest first.
+   The cursor holds for each level a node as "<link id>.<hex of the token>/": the nodes being expanded, then the next to visit ("0" when done).
+   A new link has a greater id than the existing ones and brothers are chained by id, so a node removed meanwhile is resumed
+   from the first older brother: the nodes present for the whole scan are returned once, whatever is written between the pages.
+   Returns the nodes emitted, -1 for a wildcard path or a bad cursor */
+int
+Database::scan_ (vector<string> keys, string& cursor, long count, long offset, bool deep, vector<pair<size_t, string>>& out) {
+	PathPattern p(keys);
+	if (!p.literal()) return -1;
+	vector<Iter> found;
+	get__(p, found);
+	if (found.empty()) {
+		cursor = "0";
+		return 0;
+	}
+	
+	const char* HEX = "0123456789abcdef";
+	vector<pair<long, string>> levels;
+	for (size_t at = 0; cursor != "0" and at < cursor.size(); ) {
+		size_t dot = cursor.find('.', at), end = cursor.find('/', at);
+		if (dot == string::npos or end == string::npos or dot > end or (end - dot - 1) % 2 != 0) return -1;
+		string id = cursor.substr(at, dot - at), token;
+		if (!Utils::isNaturalNumber(id)) return -1;
+		for (size_t h = dot + 1; h < end; h += 2) {
+			const char* hi = strchr(HEX, cursor[h]);
+			const char* lo = strchr(HEX, cursor[h+1]);
+			if (hi == NULL or lo == NULL or *hi == 0 or *lo == 0) return -1;
+			token += (char)((hi - HEX) * 16 + (lo - HEX));
+		}
+		levels.push_back({stol(id), token});
+		at = end + 1;
+	}
+	if (!deep and levels.size() > 1) return -1;
+	
+	vector<WalkFrame> stack;
+	Iter* parent = &found[0];
+	auto owner = HEND;
+	if (levels.empty()) stack.push_back({parent, owner, parent->last});
+	for (size_t j = 0; j < levels.size(); j++) {
+		long id = levels[j].first;
+		string& token = levels[j].second;
+		if (j + 1 == levels.size()) {
+			stack.push_back({parent, owner, olderThan(*parent, id, token, true)});
+			break;
+		}
+		
+		auto f = heap.find(token);
+		Iter* expanded = nullptr;
+		if (f != heap.end()) {
+			auto s = f->second.son_of.find(parent->id);
+			if (s != f->second.son_of.end() and s->second.id == id) expanded = &s->second;
+		}
+		if (expanded == nullptr) { // gone, and its subtree with it
+			stack.push_back({parent, owner, olderThan(*parent, id, token, false)});
+			break;
+		}
+		stack.push_back({parent, owner, expanded->prev});
+		parent = expanded;
+		owner = f;
+	}
+	
+	int emitted = 0;
+	walk(stack, deep ? -1 : 0, [&](vector<WalkFrame>& stack, map<string, Bean>::iterator node, Iter&) {
+		if (emitted == count) return WALK__STOP; // the next page starts here
+		if (offset > 0) offset--;
+		else {
+			out.push_back({stack.size() - 1, node->first});
+			emitted++;
+		}
+		return WALK__INTO;
+	});
+	
+	cursor = stack.empty() ? "0" : "";
+	for (size_t j = 0; j < stack.size(); j++) {
+		bool top = j + 1 == stack.size();
+		auto node = top ? stack[j].next : stack[j+1].node;
+		long id = top ? getAssociatedIter(node, stack[j].link->id).id : stack[j+1].link->id;
+		cursor += to_string(id) + ".";
+		for (unsigned char c : node->first) cursor += string(1, HEX[c / 16]) + HEX[c % 16];
+		cursor += "/";
+	}
+	return emitted;
+}
+
 tuple<int,int,int> Database::load() {
 	cout << "Loading data (";
 	int file_ok = touch(jrnl, this); /* create journal file if not existing */
@@ -761,6 +2157,9 @@ tuple<int,int,int> Database::load() {
 	
 	map<string, Bean>::iterator last_bar;
 	map<long, map<string, Bean>::iterator> index_cache;
+	map<long, map<long, map<string, Bean>::iterator>> sons_of; // parent x its sons by link id, for OP__COPY: built at the first one, then kept
+	bool sons_kept = false;
+	map<long, long> deadlines; // link id x its deadline, from OP__EXPIRE
 	mutex mtx;
 	int loaded = 0;
 	
@@ -782,23 +2181,26 @@ tuple<int,int,int> Database::load() {
 		cout.flush();
 	} });
 
-	while (getline(Ifile, line)) {
-		vector<string> slugs;
-		if (!line.empty() and line[0] == '#') continue;
-		parseJournalLine(line, slugs, splitter);
-		if (slugs.empty()) {
-			cerr << "Invalid load record" << endl;
-			continue;
+	auto cut = [&](map<string, Bean>::iterator it, long id) { // the link of the node under the parent id
+		if (sons_kept and it->second.son_of.count(id)) {
+			long link_id = it->second.son_of.at(id).id;
+			sons_of[id].erase(link_id);
+			sons_of.erase(link_id);
 		}
-		
-//		cout << "Load read: " << line << endl;
-		
+		int amt = it->second.son_of.erase(id);
+		if (amt <= 0) {
+			cerr << "Fatal error " << __LINE__ << endl;
+			exit(0);
+		}
+	};
+
+	auto apply = [&](vector<string>& slugs) -> void {
 		string t_op = slugs[0];
 		if (t_op == OP__INSERT) {
 //			cout << "Action 1\n";
 			if (slugs.size() <= 1) {
 				cerr << "Invalid record for OP " << OP__INSERT << endl;
-				continue;
+				return;
 			}
 			string& t_bar = slugs[1];
 
@@ -808,7 +2210,7 @@ tuple<int,int,int> Database::load() {
 //			cout << "Action 2\n";
 			if (slugs.size() <= 1) {
 				cerr << "Invalid record for OP " << OP__REFERENCE << endl;
-				continue;
+				return;
 			}
 			string t_index = slugs[1];
 			last_bar = index_cache.at(stol(t_index));
@@ -817,35 +2219,31 @@ tuple<int,int,int> Database::load() {
 //			cout << "Action 3\n";
 			if (slugs.size() <= 2) {
 				cerr << "Invalid record for OP " << OP__MATRIX << endl;
-				continue;
+				return;
 			}
 			long parent_id = stol(slugs[1]);
 			long id = stol(slugs[2]);
 
 			last_bar->second.son_of.insert({parent_id, Iter(id)}); 
 			index_cache.insert({id, last_bar});
+			if (sons_kept) sons_of[parent_id][id] = last_bar;
 		}
 		else if (t_op == OP__DEL_MA) {
 //			cout << "Action 4\n";
 			if (slugs.size() <= 2) {
 				cerr << "Invalid record for OP " << OP__DEL_MA << endl;
-				continue;
+				return;
 			}
 			long bean_id = stol(slugs[1]);
 			long id = stol(slugs[2]);
 
-			auto it = index_cache.at(bean_id);
-			int amt = it->second.son_of.erase(id);
-			if (amt <= 0) {
-				cerr << "Fatal error " << __LINE__ << endl;
-				exit(0);
-			}
+			cut(index_cache.at(bean_id), id);
 		}
 		else if (t_op == OP__DEL_NO) {
 //			cout << "Action 5\n";
 			if (slugs.size() <= 1) {
 				cerr << "Invalid record for OP " << OP__DEL_NO << endl;
-				continue;
+				return;
 			}
 			
 			long bean_id = stol(slugs[1]);
@@ -855,22 +2253,148 @@ tuple<int,int,int> Database::load() {
 		else if (t_op == OP__DROPDB) {
 //			cout << "Action 6\n";
 			heap.clear();
+			sons_of.clear();
+		}
+		else if (t_op == OP__MOVE) {
+			if (slugs.size() <= 3) {
+				cerr << "Invalid record for OP " << OP__MOVE << endl;
+				return;
+			}
+			long id = stol(slugs[1]);
+			long parent_id = stol(slugs[2]);
+			
+			auto it = index_cache.at(id);
+			auto l = it->second.son_of.begin();
+			while (l != it->second.son_of.end() and l->second.id != id) l++;
+			if (l == it->second.son_of.end()) {
+				cerr << "Fatal error " << __LINE__ << endl;
+				exit(0);
+			}
+			if (sons_kept) sons_of[l->first].erase(id);
+			auto handle = it->second.son_of.extract(l);
+			handle.key() = parent_id;
+			auto target = heap.try_emplace(slugs[3]).first;
+			target->second.son_of.insert(move(handle));
+			index_cache[id] = target;
+			if (sons_kept) sons_of[parent_id][id] = target;
+			if (it->second.son_of.empty()) heap.erase(it);
+		}
+		else if (t_op == OP__COPY) {
+			if (slugs.size() <= 4) {
+				cerr << "Invalid record for OP " << OP__COPY << endl;
+				return;
+			}
+			if (!sons_kept) {
+				for (auto it = heap.begin(); it != heap.end(); it++)
+					for (auto& l : it->second.son_of) sons_of[l.first][l.second.id] = it;
+				sons_kept = true;
+			}
+			long first = stol(slugs[4]);
+			long next = first;
+			vector<tuple<long, long, map<string, Bean>::iterator>> stack = {{stol(slugs[1]), stol(slugs[2]), heap.try_emplace(slugs[3]).first}};
+			while (!stack.empty()) { // as copy_()
+				auto [source, parent_id, node] = stack.back();
+				stack.pop_back();
+				long id = next++;
+				node->second.son_of.insert({parent_id, Iter(id)});
+				index_cache[id] = node;
+				sons_of[parent_id][id] = node;
+				auto f = sons_of.find(source);
+				if (f == sons_of.end()) continue;
+				for (auto s = f->second.rbegin(); s != f->second.rend(); s++)
+					if (s->first < first) stack.push_back({s->first, id, s->second});
+			}
+		}
+		else if (t_op == OP__EXPIRE) {
+			if (slugs.size() <= 2) {
+				cerr << "Invalid record for OP " << OP__EXPIRE << endl;
+				return;
+			}
+			long id = stol(slugs[1]);
+			long deadline = stol(slugs[2]);
+			if (deadline > 0) deadlines[id] = deadline;
+			else deadlines.erase(id);
+		}
+		else if (t_op == OP__EXPIRED) {
+			for (size_t k = 1; k < slugs.size(); k++) {
+				long id = stol(slugs[k]);
+				auto it = index_cache.at(id);
+				auto l = it->second.son_of.begin();
+				while (l != it->second.son_of.end() and l->second.id != id) l++;
+				if (l == it->second.son_of.end()) {
+					cerr << "Fatal error " << __LINE__ << endl;
+					exit(0);
+				}
+				cut(it, l->first);
+				deadlines.erase(id);
+			}
 		}
 		else if (t_op == LOG__LOAD) {
-			continue;	
+			return;	
+		}
+	};
+	
+	vector<vector<string>> unit; // records of an atomic unit not yet committed
+	bool in_unit = false;
+	
+	while (getline(Ifile, line)) {
+		vector<string> slugs;
+		if (!line.empty() and line[0] == '#') continue;
+		parseJournalLine(line, slugs, splitter);
+		if (slugs.empty()) {
+			cerr << "Invalid load record" << endl;
+			continue;
 		}
 		
+//		cout << "Load read: " << line << endl;
+		
+		if (slugs[0] == OP__BEGIN or (in_unit and slugs[0] == LOG__LOAD)) {
+			if (in_unit) cerr << "Discarded an incomplete atomic unit of " << unit.size() << " records" << endl;
+			unit.clear();
+			in_unit = slugs[0] == OP__BEGIN;
+			continue;
+		}
+		if (slugs[0] == OP__COMMIT) {
+			for (auto& u : unit) apply(u);
+			unit.clear();
+			in_unit = false;
+			continue;
+		}
+		if (in_unit) unit.push_back(slugs);
+		else if (slugs[0] == LOG__LOAD) continue;
+		else apply(slugs);
+		
 		lock_guard<mutex> lg(mtx);
 		loaded++;
 	}
+	if (in_unit) cerr << "Discarded an incomplete atomic unit of " << unit.size() << " records" << endl;
 
+	checkUUID();
+	setConnections();
+	
+	/* the links below a deleted one are left by its OP__DEL_MA: unreachable from the root, so given no up link.
+	   The deadlines of the others are put back in the wheel, the past ones expired by the ticker at once */
+	for (auto it = heap.begin(); it != heap.end();) {
+		auto& links = it->second.son_of;
+		for (auto l = links.begin(); l != links.end();) {
+			if (l->second.up == nullptr) {
+				l = links.erase(l);
+				continue;
+			}
+			auto d = deadlines.empty() ? deadlines.end() : deadlines.find(l->second.id);
+			if (d != deadlines.end()) expiring[d->first] = {&l->second, it, d->second};
+			l++;
+		}
+		it = links.empty() ? heap.erase(it) : next(it);
+	}
+	wheel.advance(Utils::getTimestampMs(), due);
+	for (auto& e : expiring) wheel.add(e.first, e.second.deadline);
+	
 	long conns = 0;
 	for (auto& i : this->heap) 
 		conns += i.second.son_of.size();
-
-	checkUUID();
-	setConnections();
 	if (!do_not_journal) reg(true, {LOG__LOAD});
+	commit();
 	
 	mtx.lock();
 	loading = false;
@@ -879,11 +2403,16 @@ tuple<int,int,int> Database::load() {
 	if (ldngthread.joinable()) ldngthread.join();
 	
 	Ifile.close();
-	return {loaded, this->heap.size(), conns};
+	tuple<int,int,int> done = {loaded, this->heap.size(), conns};
+	if (!expiring.empty()) expireLater(); // from here on the heap is under the lock
+	return done;
 }
 
 const string TITLE = "IUNI-LJUS";
 int PORT = 7212;
+string UNIX_SOCKET = ""; // when set, the server listens on it too and the cli prefers it
+TcpServer* SERVER = nullptr; // for the STATS command
+const string BUSY_REPLY = "<busy>"; // admission queue full: retry later or against a replica
 
 void cli_help() {
 	cout << "Cli options\n"
@@ -892,20 +2421,41 @@ void cli_help() {
 			"  UP 	 : go to upper node\n"
 			"  RO	 : go to root\n"
 			"  SET <...nodes>	: set nodes *\n"
+			"  SET <...nodes> : EX <s> : set nodes, the last one deleted after s seconds *\n"
+			"  EXPIRE <...nodes> : <s> : the nodes deleted after s seconds (0: never) *\n"
+			"  TTL <...nodes> : the seconds left to the node, -1 if none, -2 if missing *\n"
 			"  GET <...nodes>	: get nodes within specified path *\n"
+			"  GET <...nodes> : PREFIX <p> | RANGE <lo> <hi> : only the nodes starting with p, or from lo to hi, in token order (count too) *\n"
+			"  GET <...nodes> : [> x] [< y] [ORDER BY VALUE [DESC]] [LIMIT n] : only the nodes that are numbers, by value (>= and <= too; count too) *\n"
 			"  LS <...nodes>	: same as GET <...nodes>\n"
 			"  IS	 : check if path node exist *\n"
 			"  count <...nodes>	: count number of occurrencies\n"
+			"  DUMP <...nodes> [: JSON | BINARY] : the subtree streamed as JSON or as binary records, without holding the lock for the whole export\n"
+			"  LOAD <file>	: bulk import of a file of the server: a path per line (tokens tab separated) or JSON\n"
+			"  MGET <...nodes> ; <...nodes> ; ... : GET of each path in one request: its number of nodes (-1 if missing), then the nodes *\n"
+			"  count <...nodes> : DEEP : count the nodes of the whole subtree\n"
+			"  SUM|MIN|MAX|AVG <...nodes> : of the nodes within the path that are numbers, computed in the server *\n"
 			"  DEL	 : delete leaf node of the specified path *\n"
 //			"  PUT <...nodes>   : set nodes only if the penultimate node already exists\n"
-			"  UPDATE <...path> <old node> <new node> : updates (if exists) the old node in the path with the new node *\n"
+			"  UPDATE <...path> <old node> <new node> : updates (if exists) the old node in the path with the new node, its subtree kept *\n"
+			"  MOVE <...nodes> : <...new nodes> : the node with its subtree to the new path (1 moved, 0 if taken) *\n"
+			"  RENAME <...nodes> : <new node> : the same, under the same parent *\n"
+			"  COPY <...nodes> : <...new nodes> : a copy of the subtree at the new path, sharing its nodes (0 if taken) *\n"
+			"  RESOLVE <...nodes> : a handle @id.gen of the node, to start the paths of the next commands from it: GET @id.gen <...nodes> *\n"
 			"  DROP	 : drop db *\n"
 			"  TREE  : show tree within the specified path *\n"
+			"  TREE <...nodes> : LIMIT <n> : refused as <too large> <nodes> if over n nodes (default --tree-max)\n"
+			"  TREE <...nodes> : DEPTH <d> : only the first d levels below the path\n"
 			"  TRE	 : same as TREE\n"
 			"  TREEN : show tree within the specified path with nodes' ids\n"
 			"  TREN  : same as TREEN\n"
 			"  test	 : test server connection\n"
 			"  COMPACT	 : compact database journal\n"
+			"  STATS	 : server admission counters (accepted, rejected, queue wait), the backlog of memory to free and the nodes expiring\n"
+			"  MULTI <cmd> <...nodes> ; <cmd> <...nodes> ; ... : SET/DEL/UPD/MOVE/RENAME/COPY/EXPIRE/IS/COUNT/DROP under one lock, journaled as one atomic unit *\n"
+			"  SCAN <...nodes> [: CURSOR <c> COUNT <n> OFFSET <k> DEEP] : a page of sons (DEEP: of the subtree, with depths), then CURSOR <c> for the next one *\n"
+			"  WATCH <...nodes> [; <...nodes> ...] : print the changes (SET, DEL, UPD, MOVE, DROP) of the subtrees as they happen *\n"
+			"\nPaths accept the patterns * (any node), ** (any depth), {a,b} (one of), pre* (prefix); \\* \\{ for the literal chars\n"
 			"\n* Available in the SDKs too\n"
 		<< endl;
 	;
@@ -1014,6 +2564,47 @@ void run_cli (string connected_database, Cli::Cmd* direct_cmd) {
 				+ (i+1 == cmd.tokens.size() ? "" : "\n");
 		}
 //			cmd.print();
+		if (cmd.get(0) == "DUMP") { // written out as it arrives, until the server closes
+			markSize(tcp_serialized_cmd);
+			int exitcode = TcpClient::listen("127.0.0.1", PORT, tcp_serialized_cmd, [](const string& chunk) -> bool {
+				cout.write(chunk.data(), chunk.size());
+				return true;
+			});
+			cout << endl;
+			if (exitcode < 0) preprompt = NOT_CONNECTED;
+			return 1;
+		}
+		if (cmd.get(0) == "WATCH") { // prints the events until the server closes
+			markSize(tcp_serialized_cmd);
+			string buffer;
+			bool acked = false;
+			int exitcode = TcpClient::listen("127.0.0.1", PORT, tcp_serialized_cmd, [&buffer, &acked](const string& chunk) -> bool {
+				buffer += chunk;
+				while (buffer.size() > 8 and Utils::isNaturalNumber(buffer.substr(0, 8))) {
+					size_t size = stol(buffer.substr(0, 8));
+					if (buffer.size() < 9 + size) break;
+					vector<string> lines;
+					Utils::getLines(buffer.substr(9, size), lines);
+					buffer.erase(0, 9 + size);
+					
+					if (!acked) {
+						acked = true;
+						cout << "Watching (" << (lines.empty() ? "" : lines[0]) << "), ctrl-c to stop" << endl;
+						continue;
+					}
+					for (int i=1; i<lines.size(); i++) 
+						cout << webDeserialize(lines[i]) << (i+1 == lines.size() ? "" : " ");
+					cout << endl;
+				}
+				if (!acked and !buffer.empty() and !Utils::isNaturalNumber(buffer.substr(0, min<size_t>(8, buffer.size())))) {
+					cout << buffer << endl; // refused, e.g. -1
+					return false;
+				}
+				return true;
+			});
+			if (exitcode < 0) preprompt = NOT_CONNECTED;
+			return 1;
+		}
 ASK:
 		string answer;
 		markSize(tcp_serialized_cmd);
@@ -1065,182 +2656,1075 @@ std::string createUniqueFile(const std::string& desiredFileName) {
     return fileName;
 }
 
-int Database::compact() {
-	// lock shared resources with mutexes TODO
+int Database::compact() {
+	// lock shared resources with mutexes TODO
+	
+	// close jrnl
+	cerr << "Functionality not implemented yet.\n";
+	return -1;
+	
+	// STEP BY STEP:
+	
+	// close journal file and open a temporary one
+	this->close();
+	
+	string tmp_journal = createUniqueFile(this->jrnl + "_tmp");
+	this->jfile = new ofstream(tmp_journal, ios::app);
+	
+	struct Instruction {
+		string action;
+		string s1;
+		string s2;	
+		
+		Instruction(vector<string> slugs) {
+			action = slugs[0];
+			if (slugs.size() < 2) return;
+			s1 = slugs[1];
+			if (slugs.size() < 3) return;
+			s2 = slugs[2];
+		}
+		
+		void print() {
+			cout << "A: " << action << ", s1: " << s1 << ", s2: " << s2 << endl;	
+		}
+	};
+	
+	vector<Instruction> ci;
+	
+	auto check = [&ci](Instruction& i){
+		// load each line journaling in a vector, deliting eventuals calcelations
+		// compact core
+	};
+	
+	// read each line of the journal, as in the load
+	const char* splitter = new char('|');
+	string line;
+	ifstream Jf (jrnl);
+	while (getline(Jf, line)) {
+		vector<string> slugs;
+		if (!line.empty() and line[0] == '#') continue;
+		parseJournalLine(line, slugs, splitter);
+		
+		if (slugs.empty()) {
+			cerr << "Invalid load record" << endl;
+			continue;
+		}
+		
+		Instruction i(slugs);
+		i.print();
+		
+		check(i);
+	}
+	
+	Jf.close();
+	this->close();
+	
+	// rename the journal as old, and flush the compacted one into the same name file
+	// flush the temporary journal's instructions into the new compacted journal
+	
+	// continue now reusing the normal journaling
+	this->jfile = new ofstream(jrnl, ios::app);
+	
+	return 0;
+}
+
+/* outcome of a command, rendered by the text or by the binary protocol */
+const int ST__OK = 0;
+const int ST__ERROR = 1; // text "-1"
+const int ST__FATAL = 2; // text "-2"
+const int ST__UNKNOWN = 3; // text "Unknown command."
+
+struct Reply {
+	int status = ST__UNKNOWN;
+	vector<string> tokens;
+	bool listing = false; // tokens are a list of nodes (text: one per line, "<none>" if empty)
+	
+	void set(string token) { status = ST__OK; tokens.clear(); tokens.push_back(move(token)); }
+	void fail(int st) { status = st; tokens.clear(); }
+};
+
+void execute(Database& db, string& action, vector<string>& pars, Reply& reply);
+
+long TREE__MAX = 0; // --tree-max: a TREE over this many nodes is refused (0: no limit)
+const string TREE__TOO_LARGE = "<too large>"; // followed by the nodes of the tree
+
+/* a1 a2 ... ; b1 b2 ... ; ... (a literal ; is \;) */
+vector<vector<string>> splitBatch(const vector<string>& pars) {
+	vector<vector<string>> batch(1);
+	for (auto& p : pars) {
+		if (p == ";") { batch.emplace_back(); continue; }
+		batch.back().push_back(p == "\\;" ? ";" : p);
+	}
+	if (batch.back().empty()) batch.pop_back(); // trailing ;
+	return batch;
+}
+
+/* MULTI cmd1 args... ; cmd2 args... ; ...
+   all the commands run under the lock already taken by serve(), and are journaled as one atomic unit */
+const vector<string> MULTI__ALLOWED = {"SET", "DEL", "UPD", "MOVE", "RENAME", "COPY", "EXPIRE", "IS", "COUNT", "DROP"};
+
+void multi(Database& db, vector<string>& pars, Reply& reply) {
+	vector<vector<string>> cmds = splitBatch(pars);
+	
+	for (auto& c : cmds) /* validate everything before touching the data */
+		if (c.empty() or !Utils::contains(MULTI__ALLOWED, c[0])) {
+			reply.fail(ST__ERROR);
+			return;
+		}
+	
+	reply.status = ST__OK;
+	reply.listing = true;
+	db.begin();
+	for (auto& c : cmds) {
+		Reply r;
+		vector<string> args(c.begin()+1, c.end());
+		execute(db, c[0], args, r);
+		reply.tokens.push_back(r.status == ST__OK and !r.tokens.empty() ? r.tokens[0] : "-1");
+	}
+	db.end();
+}
+
+/* <path> : <options> (a literal : in the path is \:) */
+void splitOptions(const vector<string>& pars, vector<string>& path, vector<string>& options) {
+	size_t k = 0;
+	for (; k < pars.size() and pars[k] != ":"; k++)
+		path.push_back(pars[k] == "\\:" ? ":" : pars[k]);
+	if (k < pars.size()) options.assign(pars.begin() + k + 1, pars.end());
+}
+
+/* EX, EXPIRE: up to 9 digits of seconds (0: no deadline) */
+bool isSeconds(const string& s) {
+	return Utils::isNaturalNumber(s) and s.size() <= 9;
+}
+
+bool parseSonsFilter(const vector<string>& options, SonsFilter& filter) {
+	for (size_t k = 0; k < options.size(); k++) {
+		const string& o = options[k];
+		size_t left = options.size() - k - 1;
+		if (o == "PREFIX" and left >= 1) {
+			filter.prefix = true;
+			filter.lo = PathPattern::unescape(options[++k]);
+		}
+		else if (o == "RANGE" and left >= 2) {
+			filter.range = true;
+			filter.lo = PathPattern::unescape(options[++k]);
+			filter.hi = PathPattern::unescape(options[++k]);
+		}
+		else if ((o == ">" or o == ">=") and left >= 1 and Utils::toNumber(options[k+1], filter.min)) {
+			filter.numeric = true;
+			filter.minOpen = o == ">";
+			k++;
+		}
+		else if ((o == "<" or o == "<=") and left >= 1 and Utils::toNumber(options[k+1], filter.max)) {
+			filter.numeric = true;
+			filter.maxOpen = o == "<";
+			k++;
+		}
+		else if (o == "ORDER" and left >= 2 and options[k+1] == "BY" and options[k+2] == "VALUE") {
+			filter.numeric = true;
+			k += 2;
+			if (k + 1 < options.size() and (options[k+1] == "ASC" or options[k+1] == "DESC"))
+				filter.desc = options[++k] == "DESC";
+		}
+		else if (o == "LIMIT" and left >= 1 and Utils::isNaturalNumber(options[k+1]))
+			filter.limit = stol(options[++k]);
+		else if (o == "DEEP")
+			filter.deep = true;
+		else return false;
+	}
+	if (filter.deep and (filter.prefix or filter.range or filter.numeric or filter.limit >= 0)) return false;
+	return (int)filter.prefix + (int)filter.range + (int)filter.numeric <= 1;
+}
+
+/* LOAD formats. Lines: a path per line, its tokens separated by tabs (\t, \n and \\ escaped) */
+void readPathLines(const string& content, vector<vector<string>>& paths) {
+	vector<string> path;
+	string token;
+	bool escaped = false;
+	for (size_t at = 0; at <= content.size(); at++) {
+		char c = at < content.size() ? content[at] : '\n';
+		if (escaped) {
+			token += c == 'n' ? '\n' : c == 't' ? '\t' : c;
+			escaped = false;
+		}
+		else if (c == '\\') escaped = true;
+		else if (c == '\t') path.push_back(move(token)), token.clear();
+		else if (c == '\n') {
+			if (!token.empty() and token.back() == '\r') token.pop_back();
+			if (!token.empty() or !path.empty()) path.push_back(move(token));
+			if (!path.empty()) paths.push_back(move(path));
+			path.clear();
+			token.clear();
+		}
+		else token += c;
+	}
+}
+
+/* JSON, as the SDK gets a TREE: the keys are nodes, true, null or {} a leaf, a string or a number the son node, an array more sons */
+class JsonPaths {
+	const string& s;
+	size_t at = 0;
+	vector<string> path;
+	vector<vector<string>>& out;
+	
+	void ws() { while (at < s.size() and isspace((unsigned char)s[at])) at++; }
+	void leaf() { if (!path.empty()) out.push_back(path); }
+	
+	void utf8(unsigned long cp, string& t) {
+		if (cp < 0x80) t += (char)cp;
+		else if (cp < 0x800) t += (char)(0xC0 | cp >> 6), t += (char)(0x80 | (cp & 0x3F));
+		else if (cp < 0x10000) t += (char)(0xE0 | cp >> 12), t += (char)(0x80 | (cp >> 6 & 0x3F)), t += (char)(0x80 | (cp & 0x3F));
+		else t += (char)(0xF0 | cp >> 18), t += (char)(0x80 | (cp >> 12 & 0x3F)), t += (char)(0x80 | (cp >> 6 & 0x3F)), t += (char)(0x80 | (cp & 0x3F));
+	}
+	
+	bool hex4(unsigned long& cp) {
+		if (at + 4 > s.size()) return false;
+		for (size_t i = 0; i < 4; i++)
+			if (!isxdigit((unsigned char)s[at+i])) return false;
+		cp = stoul(s.substr(at, 4), nullptr, 16);
+		at += 4;
+		return true;
+	}
+	
+	bool str(string& t) {
+		if (s[at] != '"') return false;
+		for (at++; at < s.size() and s[at] != '"'; ) {
+			char c = s[at++];
+			if (c != '\\') { t += c; continue; }
+			if (at >= s.size()) return false;
+			c = s[at++];
+			unsigned long cp, low;
+			switch (c) {
+				case 'n': t += '\n'; break;
+				case 't': t += '\t'; break;
+				case 'r': t += '\r'; break;
+				case 'b': t += '\b'; break;
+				case 'f': t += '\f'; break;
+				case 'u':
+					if (!hex4(cp)) return false;
+					if (cp >= 0xD800 and cp < 0xDC00 and s.compare(at, 2, "\\u") == 0) { // surrogate pair
+						at += 2;
+						if (!hex4(low)) return false;
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					}
+					utf8(cp, t);
+					break;
+				default: t += c;
+			}
+		}
+		if (at >= s.size()) return false;
+		at++;
+		return true;
+	}
+	
+	bool key() {
+		string k;
+		ws();
+		if (at >= s.size() or !str(k)) return false;
+		ws();
+		if (s[at] != ':') return false;
+		at++;
+		path.push_back(k);
+		return true;
+	}
+	
+	bool scalar() {
+		string t;
+		if (s[at] == '"') {
+			if (!str(t)) return false;
+		}
+		else {
+			size_t from = at;
+			while (at < s.size() and (isalnum((unsigned char)s[at]) or s[at] == '-' or s[at] == '+' or s[at] == '.')) at++;
+			t = s.substr(from, at - from);
+			double n;
+			if (t == "true" or t == "null") {
+				leaf();
+				return true;
+			}
+			if (t == "false") return true; // not there
+			if (!Utils::toNumber(t, n)) return false;
+		}
+		path.push_back(t);
+		leaf();
+		path.pop_back();
+		return true;
+	}
+	
+public:
+	JsonPaths(const string& s, vector<vector<string>>& out) : s(s), out(out) {}
+	
+	/* without recursion, a deep tree is as a wide one: the containers open are on a stack, true for an object */
+	bool read() {
+		vector<bool> open;
+		while (true) {
+			ws();
+			if (at >= s.size()) return false;
+			if (s[at] == '{' or s[at] == '[') {
+				bool object = s[at++] == '{';
+				ws();
+				if (s[at] != (object ? '}' : ']')) {
+					open.push_back(object);
+					if (object and !key()) return false;
+					continue; // to its first value
+				}
+				at++;
+				leaf();
+			}
+			else if (!scalar()) return false;
+			
+			while (true) { // after a value: the next one, or the end of its container
+				if (open.empty()) {
+					ws();
+					return at == s.size();
+				}
+				bool object = open.back();
+				if (object) path.pop_back();
+				ws();
+				if (s[at] == ',') {
+					at++;
+					if (object and !key()) return false;
+					break;
+				}
+				if (s[at] != (object ? '}' : ']')) return false;
+				at++;
+				open.pop_back();
+			}
+		}
+	}
+};
+
+/* a file of the server, JSON if it starts with { or [ */
+bool readPaths(const string& file, vector<vector<string>>& paths) {
+	ifstream in(file, ios::binary);
+	if (!in) return false;
+	stringstream ss;
+	ss << in.rdbuf();
+	string content = ss.str();
+	
+	size_t first = content.find_first_not_of(" \t\r\n");
+	if (first != string::npos and (content[first] == '{' or content[first] == '['))
+		return JsonPaths(content, paths).read();
+	readPathLines(content, paths);
+	return true;
+}
+
+/* @id.generation, as RESOLVE gives it */
+bool isHandle(const string& token) {
+	size_t dot = token.find('.');
+	return token.size() > 3 and token[0] == '@' and dot != string::npos and dot > 1 and dot < 18
+		and Utils::isNaturalNumber(token.substr(1, dot - 1)) and Utils::isNaturalNumber(token.substr(dot + 1));
+}
+
+/* the commands whose paths can start with a handle (the new path of MOVE and COPY is from it as well) */
+const vector<string> HANDLE__ACTIONS = {"GET", "LS", "COUNT", "SET", "SUM", "MIN", "MAX", "AVG", "IS", "DEL", "UPD", "MOVE", "RENAME", "COPY",
+	"TREE", "TRE", "TREEN", "TREN", "SCAN", "RESOLVE", "EXPIRE", "TTL"};
+
+size_t CACHE__BYTES = 0; // --cache: memory of the replies kept per database (0: none)
+const vector<string> CACHE__ACTIONS = {"GET", "LS", "TREE", "TRE", "TREEN", "TREN"};
+
+/* the command as the same reply goes with: the action by its main name, the path of the base and the arguments */
+string
+Database::cacheKey (const string& action, const vector<string>& pars) {
+	string key = action == "LS" ? "GET" : action == "TRE" ? "TREE" : action == "TREN" ? "TREEN" : action;
+	for (auto& k : based) key += " " + to_string(k.size()) + ":" + k;
+	key += " @";
+	for (auto& k : pars) key += " " + to_string(k.size()) + ":" + k;
+	return key;
+}
+
+void
+Database::uncache (list<Cached>::iterator c) {
+	cache_bytes -= c->bytes;
+	cached.erase(c->key);
+	cache.erase(c);
+}
+
+/* the reply kept for the key, if nothing changed in the subtree of its link since: the stamp of the link is the same.
+   Cut or moved links (another generation) only make it look for the link again along its path */
+bool
+Database::cacheGet (const string& key, int& status, bool& listing, vector<string>& tokens) {
+	auto f = cached.find(key);
+	if (f == cached.end()) {
+		cache_misses++;
+		return false;
+	}
 	
-	// close jrnl
-	cerr << "Functionality not implemented yet.\n";
-	return -1;
+	Cached& c = *f->second;
+	if (c.generation != generation) {
+		Iter* parent;
+		map<string, Bean>::iterator node;
+		Iter* found = locate(c.path, parent, node, &root);
+		c.link = found != nullptr and found->id == c.id ? found : nullptr;
+		c.generation = generation;
+	}
+	if (c.link == nullptr or c.link->stamp != c.stamp) {
+		uncache(f->second);
+		cache_misses++;
+		return false;
+	}
 	
-	// STEP BY STEP:
+	cache.splice(cache.begin(), cache, f->second);
+	status = c.status;
+	listing = c.listing;
+	tokens = c.tokens;
+	cache_hits++;
+	return true;
+}
+
+/* the reply of the command on the path (patterns: it depends on the whole subtree of the base), the least recently
+   used ones dropped to stay within CACHE__BYTES. Not kept for a missing literal path */
+void
+Database::cachePut (const string& key, const vector<string>& keys, int status, bool listing, const vector<string>& tokens) {
+	Iter* dependency = base;
+	vector<string> path = based;
+	if (PathPattern(keys).literal()) {
+		size_t n = path.size();
+		for (auto& k : keys) path.push_back(PathPattern::unescape(k));
+		Iter* parent;
+		map<string, Bean>::iterator node;
+		dependency = locate(vector<string>(path.begin() + n, path.end()), parent, node);
+		if (dependency == nullptr) return;
+	}
 	
-	// close journal file and open a temporary one
-	this->close();
+	size_t bytes = sizeof(Cached) + 2 * key.size();
+	for (auto& t : tokens) bytes += sizeof(string) + t.size();
+	for (auto& k : path) bytes += sizeof(string) + k.size();
+	if (bytes > CACHE__BYTES) return;
 	
-	string tmp_journal = createUniqueFile(this->jrnl + "_tmp");
-	this->jfile = new ofstream(tmp_journal, ios::app);
+	auto f = cached.find(key);
+	if (f != cached.end()) uncache(f->second);
+	cache.push_front({key, status, listing, tokens, path, dependency->id, dependency, dependency->stamp, generation, bytes});
+	cached[key] = cache.begin();
+	cache_bytes += bytes;
+	while (cache_bytes > CACHE__BYTES) {
+		uncache(prev(cache.end()));
+		cache_evictions++;
+	}
+}
+
+vector<string>
+Database::cacheStats () {
+	return {
+		"cache_hits " + to_string(cache_hits),
+		"cache_misses " + to_string(cache_misses),
+		"cache_evictions " + to_string(cache_evictions),
+		"cache_entries " + to_string(cache.size()),
+		"cache_bytes " + to_string(cache_bytes)
+	};
+}
+
+void dispatch(Database& db, string& action, vector<string>& pars, Reply& reply);
+
+void execute(Database& db, string& action, vector<string>& pars, Reply& reply) {
+	if (!pars.empty() and isHandle(pars[0]) and Utils::contains(HANDLE__ACTIONS, action)) { // the command from the node of the handle
+		if (!db.rebase(pars[0])) {
+			reply.fail(ST__ERROR);
+			return;
+		}
+		vector<string> rest(pars.begin() + 1, pars.end());
+		execute(db, action, rest, reply);
+		db.rebase("");
+		return;
+	}
 	
-	struct Instruction {
-		string action;
-		string s1;
-		string s2;	
-		
-		Instruction(vector<string> slugs) {
-			action = slugs[0];
-			if (slugs.size() < 2) return;
-			s1 = slugs[1];
-			if (slugs.size() < 3) return;
-			s2 = slugs[2];
+	if (CACHE__BYTES == 0 or !Utils::contains(CACHE__ACTIONS, action)) {
+		dispatch(db, action, pars, reply);
+		return;
+	}
+	string key = db.cacheKey(action, pars);
+	if (db.cacheGet(key, reply.status, reply.listing, reply.tokens)) return;
+	dispatch(db, action, pars, reply);
+	vector<string> path, options;
+	splitOptions(pars, path, options);
+	if (reply.status == ST__OK) db.cachePut(key, path, reply.status, reply.listing, reply.tokens);
+}
+
+void dispatch(Database& db, string& action, vector<string>& pars, Reply& reply) {
+	if (action == "GET" or action == "LS" or action == "COUNT") { // [: PREFIX p | RANGE lo hi | ... | DEEP]
+		vector<string> path, options;
+		SonsFilter filter;
+		splitOptions(pars, path, options);
+		if (!parseSonsFilter(options, filter) or (filter.deep and action != "COUNT")) {
+			reply.fail(ST__ERROR);
+			return;
 		}
 		
-		void print() {
-			cout << "A: " << action << ", s1: " << s1 << ", s2: " << s2 << endl;	
+		if (action == "COUNT" and (options.empty() or filter.deep)) {
+			reply.set(to_string(db.count_(path, filter.deep)));
+			return;
+		}
+		auto r = db.get_(path, filter);
+		if (action == "COUNT") reply.set(to_string(get<1>(r)));
+		else {
+			reply.status = ST__OK;
+			reply.listing = true;
+			reply.tokens = move(get<0>(r));
+		}
+	}
+	else if (action == "SET") { // [: EX s]
+		size_t n = pars.size();
+		if (n < 3 or pars[n-3] != ":" or pars[n-2] != "EX") {
+			reply.set(to_string(db.set_(pars)));
+			return;
+		}
+		if (!isSeconds(pars[n-1])) {
+			reply.fail(ST__ERROR);
+			return;
+		}
+		vector<string> path(pars.begin(), pars.end() - 3);
+		db.begin();
+		int amt = db.set_(path);
+		db.expire_(path, stol(pars[n-1]));
+		db.end();
+		reply.set(to_string(amt));
+	}
+	else if (action == "EXPIRE") { // EXPIRE <path> : <s>
+		vector<string> path, options;
+		splitOptions(pars, path, options);
+		if (path.empty() or options.size() != 1 or !isSeconds(options[0])) reply.fail(ST__ERROR);
+		else reply.set(to_string(db.expire_(path, stol(options[0]))));
+	}
+	else if (action == "TTL")
+		reply.set(to_string(db.ttl_(pars)));
+	else if (action == "SUM" or action == "MIN" or action == "MAX" or action == "AVG") {
+		double result;
+		long n = db.aggregate_(pars, action, result);
+		if (n < 0) reply.fail(ST__ERROR);
+		else if (n == 0 and action != "SUM") reply.set("<empty>");
+		else reply.set(Utils::formatNumber(result));
+	}
+	else if (action == "IS")
+		reply.set(to_string(db.is_(pars)));
+	else if (action == "DEL")
+		reply.set(to_string(db.del_(pars)));
+//	else if (action == "PUT") 
+//		reply.set(to_string(db.put_(pars)));
+	else if (action == "UPD") {
+		if (pars.size() < 3)
+			reply.fail(ST__ERROR);
+		else 
+		{
+			vector<string> old_nodes;
+			vector<string> new_nodes;
+			bool old = true;
+			for (int k=0; k<pars.size(); k++) {
+				if (pars[k] == ":") { old = false; continue; }
+				(old ? old_nodes : new_nodes).push_back(pars[k]);
+				for (auto& k : old_nodes) if (k == "\\:") k = ":";
+				for (auto& k : new_nodes) if (k == "\\:") k = ":";
+			}
+			if (old_nodes.empty() or new_nodes.empty()) reply.fail(ST__ERROR);
+			else
+			reply.set(to_string(db.upd_(old_nodes, new_nodes)));
+		}
+	}
+	else if (action == "MOVE" or action == "RENAME") { // MOVE <path> : <new path>, RENAME <path> : <new node>
+		vector<string> from, to;
+		splitOptions(pars, from, to);
+		for (auto& k : to) if (k == "\\:") k = ":";
+		if (from.empty() or to.empty() or (action == "RENAME" and to.size() != 1)) {
+			reply.fail(ST__ERROR);
+			return;
+		}
+		if (action == "RENAME") to.insert(to.begin(), from.begin(), from.end()-1);
+		int moved = db.move_(from, to);
+		if (moved < 0) reply.fail(ST__ERROR);
+		else reply.set(to_string(moved));
+	}
+	else if (action == "COPY") { // COPY <path> : <new path>
+		vector<string> from, to;
+		splitOptions(pars, from, to);
+		for (auto& k : to) if (k == "\\:") k = ":";
+		long copied = from.empty() or to.empty() ? -1 : db.copy_(from, to);
+		if (copied < 0) reply.fail(ST__ERROR);
+		else reply.set(to_string(copied));
+	}
+	else if (action == "RESOLVE") { // RESOLVE <path>: @id.generation, a path prefix for the next commands
+		string handle = db.resolve_(pars);
+		if (handle.empty()) reply.fail(ST__ERROR);
+		else reply.set(handle);
+	}
+	else if (action == "DROP") 
+		reply.set(to_string(db.drop_()));
+	else if (action == "TREE" or action == "TRE" or action == "TREEN" or action == "TREN") { // [: [LIMIT n] [DEPTH d]]
+		vector<string> path, options;
+		splitOptions(pars, path, options);
+		long limit = TREE__MAX, depth = -1;
+		for (size_t k = 0; k < options.size(); k += 2) {
+			if (k + 1 == options.size() or !Utils::isNaturalNumber(options[k+1]) or (options[k] != "LIMIT" and options[k] != "DEPTH")) {
+				reply.fail(ST__ERROR);
+				return;
+			}
+			(options[k] == "LIMIT" ? limit : depth) = stol(options[k+1]);
 		}
-	};
-	
-	vector<Instruction> ci;
-	
-	auto check = [&ci](Instruction& i){
-		// load each line journaling in a vector, deliting eventuals calcelations
-		// compact core
-	};
-	
-	// read each line of the journal, as in the load
-	const char* splitter = new char('|');
-	string line;
-	ifstream Jf (jrnl);
-	while (getline(Jf, line)) {
-		vector<string> slugs;
-		if (!line.empty() and line[0] == '#') continue;
-		parseJournalLine(line, slugs, splitter);
 		
-		if (slugs.empty()) {
-			cerr << "Invalid load record" << endl;
-			continue;
+		long estimate = limit > 0 ? db.count_(path, true) : 0; // from the counters, before building anything
+		if (estimate > limit) reply.set(TREE__TOO_LARGE + " " + to_string(estimate));
+		else reply.set(db.tree_(path, action == "TREEN" or action == "TREN" ? "i" : "", depth));
+	}
+	else if (action == "SCAN") { // SCAN <path> [: [CURSOR c] [COUNT n] [LIMIT n] [OFFSET k] [DEEP]]
+		vector<string> path, options;
+		string cursor = "0";
+		long count = 100, offset = 0;
+		bool deep = false, ok = true;
+		splitOptions(pars, path, options);
+		for (size_t k = 0; k < options.size() and ok; k++) {
+			string& o = options[k];
+			if (o == "DEEP") { deep = true; continue; }
+			ok = k + 1 < options.size();
+			if (!ok) break;
+			if (o == "CURSOR") cursor = options[++k];
+			else if ((o == "COUNT" or o == "LIMIT" or o == "OFFSET") and Utils::isNaturalNumber(options[k+1]))
+				(o == "OFFSET" ? offset : count) = stol(options[++k]);
+			else ok = false;
 		}
 		
-		Instruction i(slugs);
-		i.print();
+		vector<pair<size_t, string>> nodes;
+		if (ok and count > 0 and db.scan_(path, cursor, count, offset, deep, nodes) >= 0) {
+			reply.status = ST__OK;
+			reply.listing = true;
+			reply.tokens = {cursor};
+			for (auto& n : nodes) reply.tokens.push_back(deep ? to_string(n.first) + " " + n.second : n.second);
+		}
+		else reply.fail(ST__ERROR);
+	}
+	else if (action == "USE") {
+		if (pars.size() != 1) reply.fail(ST__ERROR);
+		else reply.set(to_string(DBpool.use(pars[0]).second));
+	}
+	else if (action == "COMPACT") {
+		reply.set(to_string(db.compact()));
+	}
+	else if (action == "DBLIST") {
+		reply.status = ST__OK;
+		reply.listing = true;
+		reply.tokens = DBpool.getDatabaseList();
+	}
+	else if (action == "MULTI")
+		multi(db, pars, reply);
+	else if (action == "LOAD") { // LOAD <file>: bulk import, under one lock and as one journal unit
+		auto t0 = chrono::steady_clock::now();
+		vector<vector<string>> paths;
+		if (pars.size() != 1 or !readPaths(pars[0], paths)) {
+			reply.fail(ST__ERROR);
+			return;
+		}
+		long rows = paths.size();
+		long nodes = db.bulk_(paths);
 		
-		check(i);
+		double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+		long rate = secs > 0 ? rows / secs : rows;
+		cout << "Loaded " << rows << " rows (" << nodes << " new links) from " << pars[0] << " in " << (long)(secs * 1000) << " ms, " << rate << " rows/s" << endl;
+		reply.status = ST__OK;
+		reply.listing = true;
+		reply.tokens = {
+			"rows " + to_string(rows),
+			"links " + to_string(nodes),
+			"ms " + to_string((long)(secs * 1000)),
+			"rows_per_s " + to_string(rate)
+		};
+	}
+	else if (action == "MGET") { // MGET <path> ; <path> ; ... : for each path the number of its nodes (-1 if missing), then the nodes
+		vector<pair<vector<string>, int>> results;
+		db.mget_(splitBatch(pars), results);
+		reply.status = ST__OK;
+		reply.listing = true;
+		for (auto& r : results) {
+			reply.tokens.push_back(to_string(r.second));
+			reply.tokens.insert(reply.tokens.end(), make_move_iterator(r.first.begin()), make_move_iterator(r.first.end()));
+		}
+	}
+	else if (action == "WATCH") // the subscription itself is made by the protocol, which owns the connection
+		reply.set(to_string(max<size_t>(1, splitBatch(pars).size())));
+	else if (action == "STATS") {
+		reply.status = ST__OK;
+		reply.listing = true;
+		if (SERVER != nullptr) {
+			TcpServer::Stats st = SERVER->getStats();
+			reply.tokens = {
+				"accepted " + to_string(st.accepted),
+				"rejected " + to_string(st.rejected),
+				"queued " + to_string(st.queued),
+				"served " + to_string(st.served),
+				"queue_wait_avg_us " + to_string(st.served == 0 ? 0 : st.wait_us_total / st.served),
+				"queue_wait_max_us " + to_string(st.wait_us_max)
+			};
+		}
+		reply.tokens.push_back("reclaim_backlog " + to_string(db.reclaimBacklog()));
+		reply.tokens.push_back("expiring " + to_string(db.expiringCount()));
+		if (CACHE__BYTES > 0) for (auto& c : db.cacheStats()) reply.tokens.push_back(c);
+	}
+	else if (action == "PROTO") { // protocols the client can switch to
+		reply.status = ST__OK;
+		reply.listing = true;
+		reply.tokens = {"text", "binary"};
+	}
+	else if (action == "test")
+		reply.set("Hello Cranjis!");
+}
+
+/* lines: USE <dbname> COMMAND arg0 arg1 arg2 ... already unescaped */
+void serve(vector<string>& lines, Reply& reply) {
+	if (lines.size() < 2 or lines[0] != "USE") {
+		reply.fail(ST__ERROR);
+		return;
+	}
+	auto useexit = DBpool.use(lines[1]);
+	if (useexit.first == NULL) {
+		reply.fail(ST__ERROR);
+		return;
 	}
 	
-	Jf.close();
-	this->close();
-	
-	// rename the journal as old, and flush the compacted one into the same name file
-	// flush the temporary journal's instructions into the new compacted journal
+	lines.erase(lines.begin(), lines.begin()+2); // erase context tokens (USE <dbname>)
+	if (lines.empty()) {
+		reply.fail(ST__UNKNOWN);
+		return;
+	}
+	Database& db = *(useexit.first);
 	
-	// continue now reusing the normal journaling
-	this->jfile = new ofstream(jrnl, ios::app);
+//	cout << "Executing qry" << endl;
+	db.lock(); // at the moment lock each query TODO improve granularity, but still ACIDity
+	string action = lines[0];
+	vector<string> pars = vector<string>(lines.begin()+1, lines.end());
+	execute(db, action, pars, reply);
+	db.commit();
+	db.publish();
+	db.unlock();
+}
+
+string renderText(Reply& reply) {
+	if (reply.status == ST__ERROR) return "-1";
+	if (reply.status == ST__FATAL) return "-2";
+	if (reply.status == ST__UNKNOWN) return "Unknown command.";
+	if (!reply.listing) return reply.tokens.empty() ? "" : move(reply.tokens[0]);
 	
-	return 0;
+	for (auto& i : reply.tokens)
+		i = webSerialize(i);
+	string sr = Utils::join(reply.tokens, "\n");
+	return sr == "" ? "<none>" : sr;
+}
+
+string textFrame(const string& body) { // as the requests: 8 digits of size, endl, body
+	return Utils::padLeft(to_string(body.size()), 8, '0') + "\n" + body;
 }
 
-void doWork(string req, TcpServer::Response res, bool local) {
+bool subscribe(const string&, vector<string>&, TcpServer::Response&, bool);
+bool streamDump(vector<string>&, TcpServer::Response&, bool);
+
+/* true if the connection has been taken over (WATCH) */
+bool doWork(string req, TcpServer::Response res, bool local) {
 	if (!local) cout << "[[Received qry:]]\n" << req << endl;
 	
 	vector<string> lines;
 	Utils::getLines(req, lines);
-	bool ok = true;
-	string emitting = "-1";
+	Reply reply;
 	if (lines.size() < 2) { // std command: USE <dbnam> COMMAND arg0 arg1 arg2 ...
-		res.send(emitting);
-		return;	
+		res.send("-1");
+		return false;
 	}
-	emitting = "Unknown command.";
 	
+	bool ok = true;
 	for (auto& i : lines) {
 		vector<string> t;
 		parseJournalLine(i,t,NULL);
 		if (t.size() > 1) {
 			cerr << "Fatal error " << __LINE__ << endl;
-			emitting = "-2";
+			reply.fail(ST__FATAL);
 			ok = false;
 		}
-		else i = t[0];
+		else i = t.empty() ? "" : t[0];
 	}
 	
-	if (lines[0] != "USE") {
-		emitting = "-1";
-		ok = false;
+	string db_name = lines[1];
+	if (ok and lines.size() > 2 and lines[2] == "DUMP") return streamDump(lines, res, false);
+	if (ok) serve(lines, reply);
+	bool watching = ok and reply.status == ST__OK and lines[0] == "WATCH";
+	string emitting = renderText(reply);
+	if (watching) emitting = textFrame(emitting); // from now on the connection carries frames
+	res.send(emitting);
+	if (!local) cout << "[[Emitted:]]\n" << emitting << endl;
+	return watching and subscribe(db_name, lines, res, false);
+	
+//	this_thread::sleep_for(chrono::milliseconds(500)); // favor the immediate answer to be printed rather the resource clean up
+	// now the resource cleanup can start...
+}
+
+/* binary protocol, negotiated per frame by its first byte (text frames start with a digit):
+     frame    : BIN__MAGIC, varint length, body
+     request  : opcode byte, varint token count, tokens (varint length + raw bytes), first token is the database
+     response : status byte (ST__<CODE>), varint token count, tokens
+   tokens travel raw, so no line splitting nor escaping on either side */
+const unsigned char BIN__MAGIC = 0xFF;
+const vector<string> BIN__OPCODES = { /* opcode 0: the action is the token after the database */
+	"", "GET", "SET", "IS", "DEL", "UPD", "DROP", "TREE", "TREEN", "COUNT", "USE", "COMPACT", "DBLIST", "PROTO", "test",
+	"STATS", "MULTI", "SCAN", "MGET", "MOVE", "RENAME", "COPY", "RESOLVE", "EXPIRE", "TTL"
+};
+
+/* bytes still missing to complete the last frame (text or binary) of a request, 0 if complete, -1 if unparsable */
+long frameMissing(const string& req) {
+	size_t at = 0;
+	while (at < req.size()) {
+		if ((unsigned char)req[at] == BIN__MAGIC) {
+			size_t p = at + 1;
+			unsigned long blen = 0;
+			if (!Utils::getVarint(req, p, blen)) return req.size() - at > 10 ? -1 : 1;
+			if (req.size() < p + blen) return p + blen - req.size();
+			at = p + blen;
+			continue;
+		}
+		
+		if (req.size() < at + 9) return at + 9 - req.size();
+		string str_nbytes = req.substr(at, 8);
+		if (!Utils::isNaturalNumber(str_nbytes)) return -1;
+		size_t end = at + 9 + stol(str_nbytes);
+		if (req.size() < end) return end - req.size();
+		at = end;
 	}
-	auto useexit = DBpool.use(lines[1]);
-	if (useexit.first == NULL) {
-		emitting = "-1";
-		ok = false;
+	return 0;
+}
+
+string binaryFrame(int status, const vector<string>& tokens) {
+	string out(1, (char)status);
+	Utils::putVarint(out, tokens.size());
+	for (auto& t : tokens) {
+		Utils::putVarint(out, t.size());
+		out += t;
 	}
 	
-	lines.erase(lines.begin(), lines.begin()+2); // erase context tokens (USE <dbname>)
-	Database& db = *(useexit.first);
+	string frame(1, (char)BIN__MAGIC);
+	Utils::putVarint(frame, out.size());
+	return frame + out;
+}
+
+void Watchers::add(const string& db, const vector<vector<string>>& paths, int socket, bool binary) {
+	lock_guard<mutex> lg(mtx);
+	Node& trie = tries[db];
+	for (auto& p : paths) {
+		Node* n = &trie;
+		for (auto& k : p) n = &n->sons[k];
+		n->sockets.push_back(socket);
+	}
+	watchers[socket] = {db, binary, paths};
+	count++;
+}
+
+/* watchers on the prefixes of path, and with deep on the whole subtree below it */
+void Watchers::collect(Node& n, const vector<string>& path, size_t at, bool deep, set<int>& out) {
+	if (at == path.size()) {
+		if (deep) all(n, out);
+		else out.insert(n.sockets.begin(), n.sockets.end());
+		return;
+	}
+	out.insert(n.sockets.begin(), n.sockets.end());
 	
-	if (ok) {
-//		cout << "Executing qry" << endl;
-		db.lock(); // at the moment lock each query TODO improve granularity, but still ACIDity
-		string action = lines[0];
-		vector<string> pars = vector<string>(lines.begin()+1, lines.end());
-		if (action == "GET" or action == "LS") {
-			auto r = db.get_(pars);
-			for (auto& i : get<0>(r))
-				i = webSerialize(i);
-			string sr = Utils::join(get<0>(r), "\n");
-			emitting = sr == "" ? "<none>" : sr;
-		}
-		else if (action == "SET")
-			emitting = to_string(db.set_(pars));
-		else if (action == "IS")
-			emitting = to_string(db.is_(pars));
-		else if (action == "DEL")
-			emitting = to_string(db.del_(pars));
-//		else if (action == "PUT") 
-//			emitting = to_string(db.put_(pars));
-		else if (action == "UPD") {
-			if (pars.size() < 3)
-				emitting = "-1";					
-			else 
-			{
-				vector<string> old_nodes;
-				vector<string> new_nodes;
-				bool old = true;
-				for (int k=0; k<pars.size(); k++) {
-					if (pars[k] == ":") { old = false; continue; }
-					(old ? old_nodes : new_nodes).push_back(pars[k]);
-					for (auto& k : old_nodes) if (k == "\\:") k = ":";
-					for (auto& k : new_nodes) if (k == "\\:") k = ":";
+	auto f = n.sons.find(path[at] == "*" ? "\\*" : path[at]);
+	if (f != n.sons.end()) collect(f->second, path, at+1, deep, out);
+	f = n.sons.find("*");
+	if (f != n.sons.end()) collect(f->second, path, at+1, deep, out);
+}
+
+void Watchers::all(Node& n, set<int>& out) {
+	out.insert(n.sockets.begin(), n.sockets.end());
+	for (auto& s : n.sons) all(s.second, out);
+}
+
+/* true if the node is left empty */
+bool Watchers::unwatch(Node& n, const vector<string>& path, size_t at, int socket) {
+	if (at == path.size()) {
+		n.sockets.erase(remove(n.sockets.begin(), n.sockets.end(), socket), n.sockets.end());
+	}
+	else {
+		auto f = n.sons.find(path[at]);
+		if (f != n.sons.end() and unwatch(f->second, path, at+1, socket)) n.sons.erase(f);
+	}
+	return n.sons.empty() and n.sockets.empty();
+}
+
+void Watchers::drop(int socket) {
+	auto w = watchers.find(socket);
+	if (w == watchers.end()) return;
+	Node& trie = tries[w->second.db];
+	for (auto& p : w->second.paths) unwatch(trie, p, 0, socket);
+	watchers.erase(w);
+	count--;
+	close(socket);
+}
+
+/* events in text : EVENT, type, path nodes (and for UPD ":" and the new nodes), one per line
+             binary : the same tokens, status ST__OK
+   a watcher not able to take an event at once (gone, or not reading) is dropped */
+void Watchers::deliver(const string& db, vector<WatchEvent>& events) {
+	lock_guard<mutex> lg(mtx);
+	auto t = tries.find(db);
+	if (t == tries.end()) return;
+	
+	for (auto& e : events) {
+		set<int> sockets;
+		collect(t->second, e.path, 0, e.type != "SET", sockets);
+		if (e.type == "UPD" and !e.path.empty()) { // and who watches where the node is now
+			vector<string> moved(e.path.begin(), e.path.end()-1);
+			moved.insert(moved.end(), e.to.begin(), e.to.end());
+			collect(t->second, moved, 0, false, sockets);
+		}
+		if (e.type == "MOVE") collect(t->second, e.to, 0, false, sockets); // the whole new path
+		if (sockets.empty()) continue;
+		
+		vector<string> tokens = {"EVENT", e.type};
+		for (auto& k : e.path) tokens.push_back(k == ":" ? "\\:" : k);
+		if (!e.to.empty()) tokens.push_back(":");
+		for (auto& k : e.to) tokens.push_back(k == ":" ? "\\:" : k);
+		string text, binary;
+		
+		for (int socket : sockets) {
+			string& frame = watchers.at(socket).binary ? binary : text;
+			if (frame.empty()) {
+				if (&frame == &binary) frame = binaryFrame(ST__OK, tokens);
+				else {
+					vector<string> lines;
+					for (auto& k : tokens) lines.push_back(webSerialize(k));
+					frame = textFrame(Utils::join(lines, "\n"));
 				}
-				if (old_nodes.empty() or new_nodes.empty()) emitting = "-1";
-				else
-				emitting = to_string(db.upd_(old_nodes, new_nodes));
 			}
+			if (::send(socket, frame.data(), frame.size(), MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)frame.size())
+				drop(socket);
+		}
+	}
+}
+
+/* WATCH path ; path ; ... : after the reply the connection only carries events, until it is closed */
+bool subscribe(const string& db, vector<string>& lines, TcpServer::Response& res, bool binary) {
+	vector<vector<string>> paths = splitBatch(vector<string>(lines.begin()+1, lines.end()));
+	if (paths.empty()) paths.emplace_back(); // the whole database
+	for (auto& p : paths)
+		for (auto& k : p) { // as the trie keeps them: * the wildcard, \* a literal star, the rest unescaped
+			if (k == "*") continue;
+			k = PathPattern::unescape(k);
+			if (k == "*") k = "\\*";
 		}
-		else if (action == "DROP") 
-			emitting = to_string(db.drop_());
-		else if (action == "TREE" or action == "TRE")
-			emitting = db.tree_(pars, "");
-		else if (action == "TREEN" or action == "TREN")
-			emitting = db.tree_(pars, "i");
-		else if (action == "COUNT")
-			emitting = to_string(db.count_(pars));
-		else if (action == "USE") {
-			if (pars.size() != 1) emitting = "-1";
-			else emitting = to_string(DBpool.use(pars[0]).second);
-		}
-		else if (action == "COMPACT") {
-			emitting = to_string(db.compact());
-		}
-		else if (action == "DBLIST") {
-			vector<string> dblist = DBpool.getDatabaseList();
-			emitting = Utils::join(dblist, "\n");
-		}
-		else if (action == "test")
-			emitting = "Hello Cranjis!";
+	WATCHERS.add(db, paths, res.keep(), binary);
+	return true;
+}
+
+string jsonString(const string& s) {
+	const char* HEX = "0123456789abcdef";
+	string z = "\"";
+	for (unsigned char c : s) {
+		if (c == '"' or c == '\\') z += '\\', z += c;
+		else if (c == '\n') z += "\\n";
+		else if (c < 0x20) z += "\\u00", z += HEX[c / 16], z += HEX[c % 16];
+		else z += c;
+	}
+	return z + "\"";
+}
+
+bool sendAll(int socket, const string& data) {
+	for (size_t at = 0; at < data.size(); ) {
+		ssize_t r = ::send(socket, data.data() + at, data.size() - at, MSG_NOSIGNAL);
+		if (r <= 0) return false;
+		at += r;
+	}
+	return true;
+}
+
+/* DUMP [path] [: JSON | BINARY]: the subtree streamed in chunks, each one read by a deep SCAN under the lock and sent without it,
+   so the writes go on meanwhile (the nodes there for the whole dump are in it once).
+   JSON as the SDK gets a TREE (LOAD reads it back), BINARY a record per node: varint depth, varint length, the token.
+   Raw bytes in both protocols, the end is the close of the connection; a missing or wildcard path replies an error */
+const long DUMP__CHUNK = 4096; // nodes read under one lock
+
+bool streamDump(vector<string>& lines, TcpServer::Response& res, bool binaryProtocol) {
+	vector<string> path, options;
+	splitOptions(vector<string>(lines.begin()+3, lines.end()), path, options);
+	bool binary = options.size() == 1 and options[0] == "BINARY";
+	bool ok = binary or options.empty() or (options.size() == 1 and options[0] == "JSON");
+	
+	auto used = DBpool.use(lines[1]);
+	ok = ok and used.first != NULL and PathPattern(path).literal();
+	if (ok) {
+		used.first->lock();
+		ok = used.first->is_(path) == 1;
+		used.first->unlock();
+	}
+	if (!ok) {
+		res.send(binaryProtocol ? binaryFrame(ST__ERROR, {}) : "-1");
+		return false;
+	}
+	
+	Database& db = *used.first;
+	int socket = res.keep();
+	string cursor = "0", out = binary ? "" : "{";
+	long depth = -1; // of the last node written
+	vector<pair<size_t, string>> nodes;
+	do {
+		nodes.clear();
+		db.lock();
+		int n = db.scan_(path, cursor, DUMP__CHUNK, 0, true, nodes);
 		db.unlock();
+		if (n < 0) break;
+		
+		for (auto& node : nodes) {
+			long d = node.first;
+			if (binary) {
+				Utils::putVarint(out, d);
+				Utils::putVarint(out, node.second.size());
+				out += node.second;
+				continue;
+			}
+			if (d > depth) { // a son of the last one
+				if (depth >= 0) out += ":{";
+			}
+			else {
+				out += ":true";
+				for (long k = depth; k > d; k--) out += "}";
+				out += ",";
+			}
+			out += jsonString(node.second);
+			depth = d;
+		}
+		if (!sendAll(socket, out)) break;
+		out.clear();
+	} while (cursor != "0");
+	
+	if (!binary and cursor == "0") {
+		if (depth >= 0) out += ":true";
+		for (long k = depth; k > 0; k--) out += "}";
+		sendAll(socket, out + "}");
 	}
-	res.send(emitting);
-	if (!local) cout << "[[Emitted:]]\n" << emitting << endl;
+	close(socket);
+	return true;
+}
+
+/* true if the connection has been taken over (WATCH) */
+bool doWorkBinary(const string& body, TcpServer::Response res, bool local) {
+	Reply reply;
+	vector<string> lines{"USE"};
 	
-//	this_thread::sleep_for(chrono::milliseconds(500)); // favor the immediate answer to be printed rather the resource clean up
-	// now the resource cleanup can start...
+	size_t at = 1;
+	unsigned long count = 0, len = 0;
+	bool ok = !body.empty() and Utils::getVarint(body, at, count);
+	unsigned char opcode = ok ? body[0] : 0;
+	
+	for (unsigned long i = 0; ok and i < count; i++) {
+		ok = Utils::getVarint(body, at, len) and at + len <= body.size();
+		if (!ok) break;
+		lines.push_back(body.substr(at, len));
+		at += len;
+		if (i == 0 and opcode != 0) { // after the database
+			if (opcode >= BIN__OPCODES.size()) ok = false;
+			else lines.push_back(BIN__OPCODES[opcode]);
+		}
+	}
+	
+	string db_name = lines.size() > 1 ? lines[1] : "";
+	if (!local) cout << "[[Binary qry:]] " << (lines.size() > 2 ? lines[2] : "?");
+	if (!ok) reply.fail(ST__ERROR);
+	else if (lines.size() > 2 and lines[2] == "DUMP") return streamDump(lines, res, true);
+	else serve(lines, reply);
+	if (!local) cout << " -> status " << reply.status << endl;
+	
+	res.send(binaryFrame(reply.status, reply.tokens));
+	return ok and reply.status == ST__OK and lines[0] == "WATCH" and subscribe(db_name, lines, res, true);
 }
 
 int main (int nargs, char* sargs[]) {
@@ -1260,7 +3744,12 @@ int main (int nargs, char* sargs[]) {
 		string database_name = DEFAULT_DATABASE_NAME;
 		
 		for (int i=2; i<args.size(); i++) {
-			if (args[i][0] == '@') {
+			if (args[i] == "--unix" and i+1 < args.size()) {
+				UNIX_SOCKET = args[++i];
+				TcpClient::preferLocal(UNIX_SOCKET, PORT);
+				continue;
+			}
+			if (args[i][0] == '@' and str_promtp.empty()) { // the db comes before the command, whose tokens can be handles
 				if (args[i].size() == 1) {
 					cerr << "Database name must be provided @<dbname>." << endl;
 					return 1;
@@ -1280,6 +3769,12 @@ int main (int nargs, char* sargs[]) {
 	vector<string> booted;
 	bool pendtcp = false;
 	bool mono = false;
+	int acceptors = 1;
+	int backlog = 20;
+	bool pinning = false;
+	int workers = 20;
+	int queue_depth = 64;
+	int pool_threads = 0;
 	for (auto it=args.begin(); it != args.end(); ) {
 		if ((*it).size() > 0 and (*it)[0] == '@') {
 			string booted_db = (*it).substr(1, (*it).size()-1);
@@ -1304,11 +3799,101 @@ int main (int nargs, char* sargs[]) {
 			PORT = the_port;
 			it = args.erase(it);
 		}
+		else if (*it == "--unix") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			
+			UNIX_SOCKET = *it;
+			cout << "* Enabled unix socket " << UNIX_SOCKET << endl;
+			it = args.erase(it);
+		}
+		else if (*it == "--acceptors" or *it == "--backlog" or *it == "--workers" or *it == "--queue") {
+			string flag = *it;
+			it = args.erase(it);
+			if (it == args.end()) break;
+			if (!Utils::isNaturalNumber(*it)) continue;
+			
+			int n = stoi(*it);
+			if (flag == "--acceptors") {
+				if (n == 0) n = thread::hardware_concurrency(); // one per core
+				acceptors = n;
+				cout << "* Enabled " << n << " acceptors on the port\n";
+			}
+			else if (flag == "--backlog") {
+				backlog = n;
+				cout << "* Listen backlog set to " << n << endl;
+			}
+			else if (flag == "--workers") {
+				workers = n;
+				cout << "* " << n << " workers per acceptor\n";
+			}
+			else {
+				queue_depth = n;
+				cout << "* Admission queue depth set to " << n << endl;
+			}
+			it = args.erase(it);
+		}
+		else if (*it == "--pin") {
+			pinning = true;
+			it = args.erase(it);
+			cout << "* Acceptors pinned to cpus\n";
+		}
 		else if (*it == "--mono") {
 			mono = true;
 			it = args.erase(it);
 			cout << "* Non-threaded option enabled\n";
 		}
+		else if (*it == "--io") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			
+			if (*it == "uring") {
+				io_uring_engine = Uring::available();
+				cout << (io_uring_engine ? "* io_uring engine enabled\n" : "* io_uring not available, using plain syscalls\n");
+			}
+			it = args.erase(it);
+		}
+		else if (*it == "--tree-max") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			if (!Utils::isNaturalNumber(*it)) continue;
+			
+			TREE__MAX = stol(*it);
+			cout << "* TREEs over " << TREE__MAX << " nodes refused\n";
+			it = args.erase(it);
+		}
+		else if (*it == "--tree-threads") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			if (!Utils::isNaturalNumber(*it)) continue;
+			
+			TREE__THREADS = stoi(*it);
+			cout << "* Large TREEs serialized in " << (TREE__THREADS > 0 ? to_string(TREE__THREADS) : "one per thread of the pool") << " slices\n";
+			it = args.erase(it);
+		}
+		else if (*it == "--cache") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			if (!Utils::isNaturalNumber(*it)) continue;
+			
+			CACHE__BYTES = stol(*it) << 20;
+			cout << "* Replies of GET and TREE cached, up to " << *it << " MB per database\n";
+			it = args.erase(it);
+		}
+		else if (*it == "--pool") {
+			it = args.erase(it);
+			if (it == args.end()) break;
+			if (!Utils::isNaturalNumber(*it)) continue;
+			
+			pool_threads = stoi(*it);
+			cout << "* Query pool of " << (pool_threads > 0 ? to_string(pool_threads) : "one per core") << " threads\n";
+			it = args.erase(it);
+		}
+		else if (*it == "--fsync") {
+			journal_sync = true;
+			it = args.erase(it);
+			cout << "* Journal synced (fdatasync) at each command\n";
+		}
 		else if (*it == "--volatile") {
 			do_not_journal = true;
 			it = args.erase(it);
@@ -1328,10 +3913,24 @@ int main (int nargs, char* sargs[]) {
 		if (args[1] == "local")
 			cout << "* Server in the same process of the CLI can slow down answers being printed." << endl;
 		
+		POOL.start(pool_threads);
 		DBpool.use(!booted.empty() ? booted[0] : DEFAULT_DATABASE_NAME);
 		
 		TcpServer tcps(PORT, mono ? 1 : 0);
+		tcps.setAcceptors(acceptors);
+		tcps.setBacklog(backlog);
+		tcps.setPinning(pinning);
+		tcps.setWorkers(workers);
+		tcps.setQueueDepth(queue_depth);
+		tcps.setBusyReply(BUSY_REPLY);
+		tcps.setIOEngine(io_uring_engine);
+		SERVER = &tcps;
+		if (!UNIX_SOCKET.empty()) {
+			tcps.setUnixSocket(UNIX_SOCKET);
+			TcpClient::preferLocal(UNIX_SOCKET, PORT); // for the cli of the 'local' mode
+		}
 	
+		tcps.expect(frameMissing); // read concatenated and long requests (e.g. MULTI) entirely
 		tcps.pick([&args](string req, TcpServer::Response res) -> void {
 			// manage requests in multi thread
 			// request: 8 chars for size of the body, endl, slugs with endl as separators
@@ -1339,6 +3938,15 @@ int main (int nargs, char* sargs[]) {
 			int nbytes = 0;
 			
 			while (req.size() > 0) { // to manage concatenated requests
+				if ((unsigned char)req[0] == BIN__MAGIC) {
+					size_t at = 1;
+					unsigned long blen = 0;
+					if (!Utils::getVarint(req, at, blen) or req.size() < at + blen) break;
+					if (doWorkBinary(req.substr(at, blen), res, args[1] == "local")) return; // WATCH: nothing else on the connection
+					req = req.substr(at + blen);
+					continue;
+				}
+				
 				if (req.size() <= 8) break;
 				str_nbytes = req.substr(0, 8);
 				if (!Utils::isNaturalNumber(str_nbytes)) {
@@ -1351,7 +3959,7 @@ int main (int nargs, char* sargs[]) {
 				if (req.size() < 9 + nbytes) break;
 				real_req = req.substr(9, nbytes);
 	
-				doWork(real_req, res, args[1] == "local");
+				if (doWork(real_req, res, args[1] == "local")) return;
 				
 				// TODO check range before substr
 				req = req.substr(8 + 1 + nbytes);
@@ -1391,10 +3999,28 @@ int main (int nargs, char* sargs[]) {
 			"  cli		   : run cli\n"
 			"  cli <cmd> 	   : run one command in the cli, in the default db\n"
 			"  cli @<db> <cmd>  : run one command in the cli, in the <dbname> db\n"
+			"  cli --unix <path> : cli talks to the server through the unix socket <path>\n"
 			"  start		   : start server\n"
 			"  [no params]	   : start server\n"
 			"  local		   : start server and run cli in the same process\n"
 			"  help		   : this help\n"
+			"Server flags:\n"
+			"  --port <n>	   : tcp port (default 7212)\n"
+			"  --unix <path>	   : listen also on the unix domain socket <path>\n"
+			"  --acceptors <n>  : n listening sockets on the port (SO_REUSEPORT), each with its workers; 0 = one per core\n"
+			"  --backlog <n>	   : listen backlog (default 20)\n"
+			"  --pin		   : pin each acceptor and its workers to a cpu\n"
+			"  --workers <n>	   : handler threads per acceptor (default 20)\n"
+			"  --queue <n>	   : connections waiting for a worker before answering <busy> (default 64, at least 1)\n"
+			"  --mono	   : non-threaded server\n"
+			"  --io uring	   : socket and journal I/O through io_uring, if available\n"
+			"  --tree-max <n>   : refuse the TREEs over n nodes, estimated from the subtree counters (default 0: no limit)\n"
+			"  --tree-threads <n> : slices of a large TREE, serialized on the pool (default 0: one per thread of the pool)\n"
+			"  --cache <MB>	   : keep the replies of GET and TREE, up to MB per database, until their subtree changes (default 0: none)\n"
+			"  --pool <n>	   : threads a large query (GET fan-out, TREE) is split over, the caller included (default 0: one per core)\n"
+			"  --fsync	   : fdatasync the journal at the end of each command\n"
+			"  --volatile	   : do not journal\n"
+			"  --pend	   : wait for the port to be free\n"
 	;
 
 	return 0;	
@@ -0,0 +1,151 @@
+/**********************************************************
+* Copyright 2025 Andrea Sorato.
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS AS IS AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+* OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+* OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* This file is part of iuni-ljus. Official website: iuni-ljus.org . 
+***********************************************************/
+
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* work-stealing pool: a deque of tasks per worker, the worker takes the newest of its own and, with none left,
+   steals the oldest of the others, so the tasks that turn out longer than the rest even out among the workers
+   usage:
+     WorkPool pool;
+     pool.start(0);                             // threads working on a run(), the caller included (0: one per core)
+     pool.run(n, [&](size_t i) { ... });        // i in [0, n): returns once all are done, the caller working too
+   with one thread (or not started) run() is a plain loop on the caller */
+class WorkPool {
+	struct Batch {
+		std::function<void(size_t)>* work;
+		std::atomic<size_t> left;
+		std::mutex mtx;
+		std::condition_variable done;
+	};
+	struct Task {
+		Batch* batch;
+		size_t i;
+	};
+	struct Queue {
+		std::mutex mtx;
+		std::deque<Task> tasks;
+	};
+	
+	std::vector<std::unique_ptr<Queue>> queues; // one per worker
+	std::vector<std::thread> workers;
+	std::mutex mtx;
+	std::condition_variable wake; // idle workers
+	std::atomic<long> queued{0};
+	std::atomic<size_t> spread{0}; // queue of the first task of the next batch
+	bool stopping = false;
+	
+	/* the newest task of queue q, or the oldest of another one */
+	bool take(size_t q, Task& t) {
+		for (size_t k = 0; k < queues.size(); k++) {
+			Queue& from = *queues[(q + k) % queues.size()];
+			std::lock_guard<std::mutex> lg(from.mtx);
+			if (from.tasks.empty()) continue;
+			if (k == 0) {
+				t = from.tasks.back();
+				from.tasks.pop_back();
+			}
+			else {
+				t = from.tasks.front();
+				from.tasks.pop_front();
+			}
+			queued--;
+			return true;
+		}
+		return false;
+	}
+	
+	void perform(Task& t) {
+		(*t.batch->work)(t.i);
+		std::lock_guard<std::mutex> lg(t.batch->mtx); // the caller frees the batch once left is 0 and the lock released
+		if (--t.batch->left == 0) t.batch->done.notify_all();
+	}
+	
+	void loop(size_t q) {
+		Task t;
+		while (true) {
+			if (take(q, t)) {
+				perform(t);
+				continue;
+			}
+			std::unique_lock<std::mutex> lk(mtx);
+			wake.wait(lk, [this] { return stopping or queued > 0; });
+			if (stopping) return;
+		}
+	}
+	
+public:
+	WorkPool() {}
+	WorkPool(const WorkPool&) = delete;
+	
+	void start(unsigned threads) {
+		if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+		for (unsigned k = 1; k < threads; k++) queues.emplace_back(new Queue());
+		for (size_t k = 0; k < queues.size(); k++) workers.emplace_back(&WorkPool::loop, this, k);
+	}
+	
+	size_t size() {
+		return workers.size() + 1;
+	}
+	
+	void run(size_t n, std::function<void(size_t)> work) {
+		if (workers.empty() or n < 2) {
+			for (size_t i = 0; i < n; i++) work(i);
+			return;
+		}
+		
+		Batch b;
+		b.work = &work;
+		b.left = n;
+		size_t first = spread++;
+		for (size_t i = 0; i < n; i++) { // round robin, so every worker starts at once
+			Queue& q = *queues[(first + i) % queues.size()];
+			std::lock_guard<std::mutex> lg(q.mtx);
+			q.tasks.push_back({&b, i});
+			queued++;
+		}
+		{
+			std::lock_guard<std::mutex> lg(mtx); // a worker past its check of queued is waiting by now: no wake lost
+		}
+		wake.notify_all();
+		
+		Task t;
+		while (b.left > 0 and take(first % queues.size(), t)) perform(t); // the tasks taken may be of other batches
+		std::unique_lock<std::mutex> lk(b.mtx);
+		b.done.wait(lk, [&b] { return b.left == 0; });
+	}
+	
+	~WorkPool() {
+		{
+			std::lock_guard<std::mutex> lg(mtx);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (auto& w : workers) w.join();
+	}
+};
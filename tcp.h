@@ -33,6 +33,9 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <cerrno>
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
@@ -40,6 +43,13 @@
 #include <arpa/inet.h>
 #include <cstring>
 #include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <memory>
+#include "uring.h"
 
 using namespace std;
 
@@ -57,6 +67,33 @@ using namespace std;
 //  string response;
 //  TcpClient::send("127.0.0.1", 8000, "This is a send test", response);
 //  cout << "Response: " << response << endl;
+//
+//  // Four acceptors sharing the port (SO_REUSEPORT), each with its own workers and pinned to a cpu
+//  tcps.setAcceptors(4);
+//  tcps.setBacklog(1024);
+//  tcps.setPinning(true);
+//
+//  // Each acceptor queues at most 64 connections for its 20 workers, then answers "BUSY" and closes
+//  tcps.setWorkers(20);
+//  tcps.setQueueDepth(64);
+//  tcps.setBusyReply("BUSY");
+//
+//  // Requests longer than one read: tell the server how many bytes are still missing
+//  tcps.expect([](const string& req) -> long { return req.size() < 100 ? 100 - req.size() : 0; });
+//
+//  // Socket receive, send and close through an io_uring per worker (plain syscalls if not available)
+//  tcps.setIOEngine(true);
+//
+//  // Long lived connection (e.g. subscriptions): the handler keeps the socket and closes it when done
+//  tcps.pick([](string req, TcpServer::Response res) -> void {
+//  	res.send("OK");
+//  	int socket = res.keep();
+//  });
+//  TcpClient::listen("127.0.0.1", 8000, "SUBSCRIBE", [](const string& chunk) -> bool { cout << chunk; return true; });
+//
+//  // Same server also reachable through a unix domain socket
+//  tcps.setUnixSocket("/tmp/server.sock");
+//  TcpClient::preferLocal("/tmp/server.sock", 8000); // loopback sends to port 8000 now go through the socket file
 
 
 class TcpServer {
@@ -96,13 +133,41 @@ public:
 	
 	class Response {
 		int socket;
+		shared_ptr<string> pending; // io_uring engine: replies gathered, then sent linked to the close
+		shared_ptr<bool> kept = make_shared<bool>(false);
 	public:
 		Response(int socket) : socket(socket) {};
+		Response(int socket, shared_ptr<string> pending) : socket(socket), pending(pending) {};
+		
+		/* the caller takes the connection over: it is not closed after the request, closing it is up to the caller */
+		int keep() {
+			if (pending) { // what was gathered so far goes out now
+				size_t at = 0;
+				while (at < pending->size()) {
+					ssize_t r = ::send(socket, pending->data() + at, pending->size() - at, MSG_NOSIGNAL);
+					if (r <= 0) break;
+					at += r;
+				}
+				pending->clear();
+				pending.reset();
+			}
+			*kept = true;
+			return socket;
+		}
+		
+		bool isKept() {
+			return *kept;
+		}
 
-		void send(string content) {
-		    const char* c_content = content.c_str();
+		void send(const string& content) {
+			if (pending) {
+				*pending += content;
+				return;
+			}
+			
+		    const char* c_content = content.data(); // may be binary, so no strlen
 //			cout << "Sending to " << socket << " {" << c_content << "}\n";
-			int bytes_sent = ::send(socket, c_content, strlen(c_content), MSG_NOSIGNAL); //Send the response to the client
+			int bytes_sent = ::send(socket, c_content, content.size(), MSG_NOSIGNAL); //Send the response to the client
 //			cout << "byte sent: " << bytes_sent << endl;
 			if (bytes_sent == -1) {
 				// error or unreachable
@@ -110,17 +175,126 @@ public:
 		}
 	};
 
+	struct Stats {
+		long accepted = 0;
+		long rejected = 0; // answered with the busy reply, queue full
+		long queued = 0; // waiting for a worker right now
+		long served = 0;
+		long wait_us_total = 0; // time spent in the queue by the served connections
+		long wait_us_max = 0;
+	};
+
 private:
+	/* bounded queue of accepted connections waiting for a worker of the acceptor */
+	class AdmissionQueue {
+		mutex mtx;
+		condition_variable cv;
+		deque<pair<int, chrono::steady_clock::time_point>> sockets;
+		size_t depth;
+		bool closed = false;
+	public:
+		AdmissionQueue(size_t depth) : depth(depth) {}
+		
+		bool push(int socket) { // false if full
+			lock_guard<mutex> lg(mtx);
+			if (sockets.size() >= depth) return false;
+			sockets.emplace_back(socket, chrono::steady_clock::now());
+			cv.notify_one();
+			return true;
+		}
+		
+		int pop(long& wait_us) { // blocks, -1 once closed
+			unique_lock<mutex> ul(mtx);
+			cv.wait(ul, [this]{ return closed or !sockets.empty(); });
+			if (sockets.empty()) return -1;
+			auto entry = sockets.front();
+			sockets.pop_front();
+			wait_us = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - entry.second).count();
+			return entry.first;
+		}
+		
+		void close() {
+			lock_guard<mutex> lg(mtx);
+			closed = true;
+			cv.notify_all();
+		}
+	};
+	
+	/* the rejected connections, drained until the client closes or their deadline passes and then closed, all on one thread:
+	   the acceptors just hand them over and go back to accept() */
+	class Reaper {
+		mutex mtx;
+		vector<pair<int, chrono::steady_clock::time_point>> incoming; // handed over, not polled yet
+		int wake[2] = {-1, -1}; // pipe that interrupts the poll when a socket is handed over, or on stop()
+		bool closed = false;
+		thread t;
+		void run();
+	public:
+		void start() {
+			if (pipe2(wake, O_NONBLOCK) == -1) return; // the sockets handed over are closed at once
+			t = thread(&Reaper::run, this);
+		}
+		
+		void add(int socket, int ms) {
+			if (!t.joinable()) {
+				::close(socket);
+				return;
+			}
+			{
+				lock_guard<mutex> lg(mtx);
+				incoming.emplace_back(socket, chrono::steady_clock::now() + chrono::milliseconds(ms));
+			}
+			char c = 0;
+			(void)!write(wake[1], &c, 1);
+		}
+		
+		void stop() {
+			if (!t.joinable()) return;
+			{
+				lock_guard<mutex> lg(mtx);
+				closed = true;
+			}
+			char c = 0;
+			(void)!write(wake[1], &c, 1);
+			t.join();
+			::close(wake[0]);
+			::close(wake[1]);
+		}
+	};
+	
+	mutex stats_mtx;
+	Stats stats;
+
 	const static int MAX_BUFFER_SIZE = 1024;
+	const static long MAX_REQUEST_SIZE = 256 * 1024 * 1024;
 	function<void(string, Response)> onPick = [](string a, Response b) -> void {};
+	function<long(const string&)> missing = [](const string&) -> long { return 0; }; // bytes still to read for a complete request
 	
     int doWork(function<void()>, bool);
-    void handle_client(int);
+    bool handle_client(int);
+    bool handle_client_uring(int, Uring&);
+    bool uring_engine = false;
 	int PORT = 8080;
 	bool nonThreaded = false;
 
 	SocketPool socket_pool;
-	int server_fd = -1;
+	int server_fd = -1; // first acceptor
+	vector<int> server_fds; // one per acceptor, all bound to PORT with SO_REUSEPORT
+	int acceptors = 1;
+	int backlog = 20;
+	bool pinning = false;
+	int workers = 20; // per acceptor
+	int queue_depth = 64; // per acceptor
+	string busy_reply = "BUSY";
+	static constexpr int BUSY_DRAIN_MS = 200; // a rejected connection is read until the client closes, at most this long
+	Reaper reaper;
+	void reject(int);
+	
+	string UNIX_PATH = ""; // optional unix domain socket listened alongside the tcp port
+	int unix_fd = -1;
+	int listenUnix();
+	int listenTcp(bool);
+	static void pinToCpu(int);
 public:
 	
 	TcpServer(int port) {
@@ -136,6 +310,52 @@ public:
 		return PORT;
 	}
 	
+	void setUnixSocket(string path) {
+		UNIX_PATH = path;
+	}
+	
+	string getUnixSocket() {
+		return UNIX_PATH;
+	}
+	
+	void setAcceptors(int n) { /* n listening sockets on the same port, the kernel balances connections among them */
+		acceptors = n < 1 ? 1 : n;
+	}
+	
+	void setBacklog(int n) {
+		backlog = n < 1 ? 1 : n;
+	}
+	
+	void setPinning(bool pin) { /* pin each acceptor, and so the workers it spawns, to a cpu */
+		pinning = pin;
+	}
+	
+	void setWorkers(int n) {
+		workers = n < 1 ? 1 : n;
+	}
+	
+	void setQueueDepth(int n) { /* accepted connections waiting for a worker before rejecting, at least one: the idle workers take them from there */
+		queue_depth = n < 1 ? 1 : n;
+	}
+	
+	void setBusyReply(string reply) { /* sent to the rejected connections, their request read and dropped */
+		busy_reply = reply;
+	}
+	
+	bool setIOEngine(bool uring) { /* false if io_uring is not available, the plain syscalls are kept */
+		uring_engine = uring and Uring::available();
+		return uring_engine == uring;
+	}
+	
+	Stats getStats() {
+		lock_guard<mutex> lg(stats_mtx);
+		return stats;
+	}
+	
+    void expect(function<long(const string&)> func) {
+    	missing = func;
+	}
+	
     void pick(function<void(string, Response)> func) {
 //    	auto doAndClose = [func](string a, Response b){
 //    		func(a, b);
@@ -159,7 +379,11 @@ public:
     
     int quit() {
     	if (server_fd == -1) return 1;
-    	close(this->server_fd);
+    	for (int fd : server_fds) close(fd);
+    	if (unix_fd != -1) {
+    		close(unix_fd);
+    		unlink(UNIX_PATH.c_str());
+    	}
     	return 0;
     }
 };
@@ -186,40 +410,228 @@ public:
 //    return true;
 //}
 
-void TcpServer::handle_client(int client_socket) {
+/* true if the socket has been already closed, or kept by the handler */
+bool TcpServer::handle_client(int client_socket) {
+	if (uring_engine) {
+		thread_local Uring ring;
+		thread_local bool ring_ready = ring.init(8);
+		if (ring_ready and ring.ready()) return handle_client_uring(client_socket, ring);
+	}
+	
     char buffer[MAX_BUFFER_SIZE];
-
-	int bytes_read = read(client_socket, buffer, MAX_BUFFER_SIZE); // put recv instead? TODO
-//    cout << "Bytes read: " << bytes_read << endl;
-	if (bytes_read <= 0) { // Client closed the connection or generic error occurred
-		return;
-    }
-	string str_buffer = string(buffer, bytes_read);
+    string str_buffer;
+    
+    do {
+		int bytes_read = read(client_socket, buffer, MAX_BUFFER_SIZE); // put recv instead? TODO
+//	    cout << "Bytes read: " << bytes_read << endl;
+		if (bytes_read <= 0) break; // Client closed the connection or generic error occurred
+		str_buffer.append(buffer, bytes_read);
+	} while (str_buffer.size() < MAX_REQUEST_SIZE and missing(str_buffer) > 0);
+	if (str_buffer.empty()) return false;
 	
 //    cout << "Readed buffer: " << "[" << str_buffer << "]" << endl;   
-	onPick(str_buffer, Response(client_socket));
+	Response res(client_socket);
+	onPick(str_buffer, res);
+	return res.isKept();
+}
+
+/* the busy reply, then a clean close: closed with the request still unread, the socket would answer with a reset and the
+   client might never read the reply. So the write side is shut (the client reads the reply up to its end) and the reaper
+   drains the request until the client closes too, bounded by BUSY_DRAIN_MS for the ones that do not */
+void TcpServer::reject(int client_socket) {
+	::send(client_socket, busy_reply.data(), busy_reply.size(), MSG_NOSIGNAL);
+	shutdown(client_socket, SHUT_WR);
+	fcntl(client_socket, F_SETFL, fcntl(client_socket, F_GETFL) | O_NONBLOCK);
+	reaper.add(client_socket, BUSY_DRAIN_MS);
+}
+
+/* one poll over the sockets being drained and the wake pipe, until the nearest deadline; a read per ready socket and round,
+   so a client that keeps sending does not hold the others */
+void TcpServer::Reaper::run() {
+	vector<pair<int, chrono::steady_clock::time_point>> draining;
+	vector<pollfd> fds;
+	char sink[4096];
+	while (true) {
+		{
+			lock_guard<mutex> lg(mtx);
+			if (closed) break;
+			draining.insert(draining.end(), incoming.begin(), incoming.end());
+			incoming.clear();
+		}
+		
+		auto now = chrono::steady_clock::now();
+		int timeout = -1;
+		fds.assign(1, {wake[0], POLLIN, 0});
+		for (auto& d : draining) {
+			fds.push_back({d.first, POLLIN, 0});
+			long left = d.second <= now ? 0 : chrono::duration_cast<chrono::milliseconds>(d.second - now).count() + 1;
+			if (timeout == -1 or left < timeout) timeout = (int)left;
+		}
+		poll(fds.data(), fds.size(), timeout);
+		if (fds[0].revents & POLLIN) while (read(wake[0], sink, sizeof(sink)) > 0);
+		
+		now = chrono::steady_clock::now();
+		size_t kept = 0;
+		for (size_t i = 0; i < draining.size(); i++) {
+			int socket = draining[i].first;
+			bool done = draining[i].second <= now;
+			if (!done and fds[i + 1].revents) {
+				ssize_t r = recv(socket, sink, sizeof(sink), 0);
+				done = r == 0 or (r < 0 and errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR); // closed by the client, or failed
+			}
+			if (done) ::close(socket);
+			else draining[kept++] = draining[i];
+		}
+		draining.resize(kept);
+	}
+	
+	for (auto& d : draining) ::close(d.first);
+	for (auto& d : incoming) ::close(d.first);
+}
+
+/* recv in one submission, then the whole reply and the close linked in a second one. A ring that fails (no entry free,
+   io_uring_enter in error) is released, with the entries not submitted, and the connection goes on with the plain syscalls,
+   as the next ones of the worker */
+bool TcpServer::handle_client_uring(int client_socket, Uring& ring) {
+	const unsigned long SEND = 1, CLOSE = 2;
+	char buffer[MAX_BUFFER_SIZE];
+	int res = -1;
+	unsigned long user_data = 0;
+	
+	string str_buffer;
+	io_uring_sqe* e;
+	
+	do {
+		e = ring.ready() ? ring.sqe() : nullptr;
+		if (e != nullptr) {
+			e->opcode = IORING_OP_RECV;
+			e->fd = client_socket;
+			e->addr = (unsigned long)buffer;
+			e->len = MAX_BUFFER_SIZE;
+			if (ring.submit(1) < 1 or !ring.next(res)) {
+				ring.release();
+				e = nullptr;
+			}
+		}
+		if (e == nullptr) res = ::read(client_socket, buffer, MAX_BUFFER_SIZE);
+		if (res <= 0) break; // Client closed the connection or generic error occurred
+		str_buffer.append(buffer, res);
+	} while (str_buffer.size() < MAX_REQUEST_SIZE and missing(str_buffer) > 0);
+	if (str_buffer.empty()) return false;
+	
+	shared_ptr<string> pending = make_shared<string>();
+	Response response(client_socket, pending);
+	onPick(str_buffer, response);
+	if (response.isKept()) return true; // the reply has already been sent by keep()
+	
+	unsigned n = 0;
+	bool queued = ring.ready();
+	if (queued and !pending->empty()) {
+		e = ring.sqe();
+		queued = e != nullptr;
+	}
+	if (queued and !pending->empty()) {
+		e->opcode = IORING_OP_SEND;
+		e->fd = client_socket;
+		e->addr = (unsigned long)pending->data();
+		e->len = pending->size();
+		e->msg_flags = MSG_NOSIGNAL;
+		e->flags = IOSQE_IO_LINK; // the close runs only after a complete send
+		e->user_data = SEND;
+		n++;
+	}
+	e = queued ? ring.sqe() : nullptr;
+	if (e != nullptr) {
+		e->opcode = IORING_OP_CLOSE;
+		e->fd = client_socket;
+		e->user_data = CLOSE;
+		n++;
+	}
+	if (e == nullptr or ring.submit(n) < (int)n) { // nothing in the kernel: all on the plain path
+		ring.release();
+		queued = false;
+	}
+	
+	int sent = 0;
+	bool closed = queued; // once submitted the close is the ring's, unless its completion tells otherwise
+	for (; queued and n > 0; n--) {
+		if (!ring.next(res, user_data)) { // what is in flight still completes
+			ring.release();
+			break;
+		}
+		if (user_data == SEND) sent = res;
+		else closed = res >= 0;
+	}
+	
+	if (!closed) { // short send broke the link, or no IORING_OP_CLOSE on this kernel
+		size_t at = sent > 0 ? sent : 0;
+		while (at < pending->size()) {
+			ssize_t r = ::send(client_socket, pending->data() + at, pending->size() - at, MSG_NOSIGNAL);
+			if (r <= 0) break;
+			at += r;
+		}
+		close(client_socket);
+	}
+	return true;
 }
  
  
-int TcpServer::doWork(function<void()> onLoad, bool waittoconnect) {
-    cout << "Starting TCP server at port " << this->PORT << endl;
-
+int TcpServer::listenUnix() {
+	struct sockaddr_un address;
+	if (UNIX_PATH.size() >= sizeof(address.sun_path)) {
+		cerr << "Error: unix socket path too long: " << UNIX_PATH << endl;
+		return -1;
+	}
+	
+	if ((unix_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("unix socket failed");
+		return -1;
+	}
+	
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, UNIX_PATH.c_str(), sizeof(address.sun_path) - 1);
+	unlink(UNIX_PATH.c_str()); // stale socket file left by a previous run
+	
+	if (bind(unix_fd, (struct sockaddr*)&address, sizeof(address)) < 0 or listen(unix_fd, backlog) < 0) {
+		perror("unix bind failed");
+		close(unix_fd);
+		unix_fd = -1;
+		return -1;
+	}
+	
+	cout << "Listening on unix socket " << UNIX_PATH << endl;
+	return 0;
+}
+ 
+/* one listening socket on PORT, SO_REUSEPORT when the port is shared among acceptors */
+int TcpServer::listenTcp(bool waittoconnect) {
     struct sockaddr_in address;
-    int addrlen = sizeof(address);
+    int fd = -1;
 
     // Creating socket file descriptor
-    if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) == 0) {
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
         perror("socket failed");
         exit(EXIT_FAILURE);
     }
+    
+    if (acceptors > 1) {
+    	int on = 1;
+    	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+    		perror("SO_REUSEPORT");
+    		close(fd);
+    		return -1;
+		}
+	}
 
     // Bind the socket to the network address and port
+    std::memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
     address.sin_port = htons(PORT);
 
 TRYBINDING:
-    if (bind(server_fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
         if (errno == EADDRINUSE) {
         	cerr << "Error: Port " << this->PORT << " is already in use." << endl;
     	} else {
@@ -232,81 +644,106 @@ TRYBINDING:
 			goto TRYBINDING;
 		}
 		
-        close(server_fd);
+        close(fd);
         exit(EXIT_FAILURE);
     }
 
     // Listen for incoming connections
-    if (listen(server_fd, 20) < 0) {
+    if (listen(fd, backlog) < 0) {
         perror("listen"); // use cerr instead TODO
-        close(server_fd);
+        close(fd);
         exit(EXIT_FAILURE);
     }
+    
+    return fd;
+}
 
-	onLoad();
+void TcpServer::pinToCpu(int cpu) {
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset) != 0)
+		cerr << "Unable to pin acceptor to cpu " << cpu << endl;
+}
+ 
+int TcpServer::doWork(function<void()> onLoad, bool waittoconnect) {
+    cout << "Starting TCP server at port " << this->PORT;
+    if (acceptors > 1) cout << " with " << acceptors << " acceptors";
+    cout << endl;
 
-	class Counter {
-		int max_tolerated = 0;
-		int counter = 0;
-		mutex mtx;
-		
-	public:
-		Counter(const int max) {
-			max_tolerated = max;
-		}
-		void add() {
-		RETRY:
-			mtx.lock();
-			if (counter == max_tolerated) {
-				mtx.unlock();
-				this_thread::sleep_for(chrono::milliseconds(100));
-				goto RETRY;
-			}
-			counter++;
-			mtx.unlock();
-		}
-		
-		void sub() {
-			mtx.lock();
-			if (counter > 0) counter--;
-			mtx.unlock();
-		}
-		
-		int get() {
-			mtx.lock();
-			int r = counter;
-			mtx.unlock();
-			return r;
-		}			
-	};
-	
-	const int MAX_THREADS = 20;
-	Counter threads_counter(MAX_THREADS);
+    for (int i = 0; i < acceptors; i++) {
+    	int fd = listenTcp(waittoconnect);
+    	if (fd == -1) break; // no SO_REUSEPORT: keep the acceptors already bound
+    	server_fds.push_back(fd);
+	}
+	if (server_fds.empty()) exit(EXIT_FAILURE);
+	server_fd = server_fds.front();
+    
+    if (!UNIX_PATH.empty()) listenUnix(); // on failure keep serving on tcp only
+
+	onLoad();
+	if (!nonThreaded) reaper.start();
 
 	auto dealer = [&](int client_socket){ // TODO del pointer
 		socket_pool.set(client_socket);
 //		socket_pool.print();
 
-		handle_client(client_socket);
-		close(client_socket);
+		if (!handle_client(client_socket))
+			close(client_socket);
 
 		socket_pool.del(client_socket);
 //		socket_pool.print();
-		
-		threads_counter.sub();
+	};
+	
+	auto fworker = [&](AdmissionQueue* queue){
+		long wait_us = 0;
+		int client_socket;
+		while ((client_socket = queue->pop(wait_us)) != -1) {
+			{
+				lock_guard<mutex> lg(stats_mtx);
+				stats.queued--;
+				stats.wait_us_total += wait_us;
+				if (wait_us > stats.wait_us_max) stats.wait_us_max = wait_us;
+			}
+			dealer(client_socket);
+			lock_guard<mutex> lg(stats_mtx);
+			stats.served++;
+		}
 	};
 
-	auto flistener = [&](){
+	auto flistener = [&](int listening_fd, int cpu){
+		if (cpu >= 0) pinToCpu(cpu); // threads spawned from here inherit the affinity
+		AdmissionQueue queue(queue_depth);
+		vector<thread> tworkers; // own worker set
+		if (!nonThreaded)
+			for (int i = 0; i < workers; i++) tworkers.emplace_back(fworker, &queue);
+		
 		while (true) {
-			int client_socket = accept(server_fd, (struct sockaddr*)&address, (socklen_t*)&addrlen);
+			int client_socket = accept(listening_fd, NULL, NULL);
+			if (client_socket < 0) {
+				if (errno == EBADF or errno == EINVAL) break; // listener closed by quit()
+				continue;
+			}
 			if (nonThreaded) {
-				dealer(client_socket);	
-			} else {
-				threads_counter.add();
-				thread thr(dealer, client_socket);
-				thr.detach();
+				dealer(client_socket);
+				continue;
+			}
+			
+			stats_mtx.lock();
+			stats.accepted++;
+			stats.queued++;
+			stats_mtx.unlock();
+			
+			if (!queue.push(client_socket)) { // fast rejection instead of stalling the accept loop
+				reject(client_socket);
+				lock_guard<mutex> lg(stats_mtx);
+				stats.queued--;
+				stats.rejected++;
 			}
 		}
+		
+		queue.close();
+		for (auto& t : tworkers) t.join();
 	};
 
 //	auto flog = [&](){
@@ -316,14 +753,19 @@ TRYBINDING:
 //		}
 //	};
 
-	thread tlistener(flistener);
+	int ncpus = thread::hardware_concurrency();
+	vector<thread> tlisteners;
+	for (size_t i = 0; i < server_fds.size(); i++)
+		tlisteners.emplace_back(flistener, server_fds[i], pinning and ncpus > 0 ? (int)(i % ncpus) : -1);
+	if (unix_fd != -1) tlisteners.emplace_back(flistener, unix_fd, -1);
 //	thread tlog(flog);
 
-	tlistener.join();
+	for (auto& t : tlisteners) t.join();
+	reaper.stop();
 //	tlog.join();
 	
-    // Close the server socket
-    close(server_fd);
+    // Close the server sockets
+    for (int fd : server_fds) close(fd);
     return 0;
 }
 
@@ -350,35 +792,16 @@ class TcpClient {
 	    return true;
 	}
 	
-public:
-	static int send(const std::string& serverIP, int serverPort, const std::string& data, std::string& response) {
-	    // Create a TCP socket
-	    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
-		if (socketFd == -1) {
-	        std::cerr << "Error creating socket" << std::endl;
-	        return -1;
-	    }
-	
-	    // Set up the server address
-	    struct sockaddr_in serverAddr;
-	    std::memset(&serverAddr, 0, sizeof(serverAddr));
-	    serverAddr.sin_family = AF_INET;
-	    serverAddr.sin_port = htons(serverPort);
-	    if (inet_pton(AF_INET, serverIP.c_str(), &serverAddr.sin_addr) != 1) {
-	        std::cerr << "Invalid server IP address" << std::endl;
-	        close(socketFd);
-	        return -1;
-	    }
-	
-	    // Connect to the server
-	    if (connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
-	        std::cerr << "Error connecting to server" << std::endl;
-	        close(socketFd);
-	        return -1;
-	    }
+	static map<int, string> local_sockets; // unix socket preferred for loopback destinations, by port
 	
+	static bool isLoopback(const std::string& serverIP) {
+		return serverIP == "127.0.0.1" or serverIP == "localhost";
+	}
+
+	/* send the data on an already connected socket, then read the response and close it */
+	static int exchange(int socketFd, const std::string& data, std::string& response) {
 	    // Send the data
-	    ssize_t bytesSent = ::send(socketFd, data.c_str(), data.length(), 0);
+	    ssize_t bytesSent = ::send(socketFd, data.c_str(), data.length(), MSG_NOSIGNAL);
 	    if (bytesSent == -1) {
 	        std::cerr << "Error sending data" << std::endl;
 	        close(socketFd);
@@ -398,6 +821,7 @@ public:
 		        std::cerr << "Error receiving data" << std::endl;
 		        goto END;
 		    }
+		    if (bytesReceived == 0) goto END; // server closed the connection
 
 			if (bytesReceived < 1024)
 				buffer[bytesReceived] = '\0';
@@ -412,8 +836,107 @@ END:
 	    return static_cast<int>(bytesSent);
 	}
 	
+	static int connectUnix(const std::string& socketPath) {
+	    struct sockaddr_un serverAddr;
+	    if (socketPath.size() >= sizeof(serverAddr.sun_path)) return -1;
+	    
+	    int socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (socketFd == -1) return -1;
+		
+	    std::memset(&serverAddr, 0, sizeof(serverAddr));
+	    serverAddr.sun_family = AF_UNIX;
+	    strncpy(serverAddr.sun_path, socketPath.c_str(), sizeof(serverAddr.sun_path) - 1);
+	    
+	    if (connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+	        close(socketFd);
+	        return -1;
+	    }
+	    return socketFd;
+	}
+
+public:
+	/* loopback sends to serverPort will go through this unix socket when it accepts connections */
+	static void preferLocal(const std::string& socketPath, int serverPort) {
+		local_sockets[serverPort] = socketPath;
+	}
+	
+	static int send(const std::string& socketPath, const std::string& data, std::string& response) {
+		int socketFd = connectUnix(socketPath);
+		if (socketFd == -1) {
+	        std::cerr << "Error connecting to unix socket " << socketPath << std::endl;
+	        return -1;
+		}
+		return exchange(socketFd, data, response);
+	}
+	
+	static int send(const std::string& serverIP, int serverPort, const std::string& data, std::string& response) {
+		int socketFd = connectTo(serverIP, serverPort);
+		if (socketFd == -1) return -1;
+	    return exchange(socketFd, data, response);
+	}
+	
+	/* send the data, then hand each chunk received to onData until the server closes or onData returns false */
+	static int listen(const std::string& serverIP, int serverPort, const std::string& data, function<bool(const string&)> onData) {
+		int socketFd = connectTo(serverIP, serverPort);
+		if (socketFd == -1) return -1;
+		
+		ssize_t bytesSent = ::send(socketFd, data.data(), data.size(), MSG_NOSIGNAL);
+		if (bytesSent == -1) {
+	        std::cerr << "Error sending data" << std::endl;
+	        close(socketFd);
+	        return -1;
+	    }
+		
+		char buffer[1024];
+		ssize_t bytesReceived;
+		while ((bytesReceived = recv(socketFd, buffer, sizeof(buffer), 0)) > 0)
+			if (!onData(string(buffer, bytesReceived))) break;
+		
+		close(socketFd);
+		return static_cast<int>(bytesSent);
+	}
+	
 	static int send(const std::string& serverIP, int serverPort, const std::string& data) {
 		string hidden_response;
 		return send(serverIP, serverPort, data, hidden_response);
 	}
+	
+private:
+	/* connected socket, through the unix socket preferred for this loopback destination, -1 on failure */
+	static int connectTo(const std::string& serverIP, int serverPort) {
+		auto local = local_sockets.find(serverPort);
+		if (local != local_sockets.end() and isLoopback(serverIP)) {
+			int socketFd = connectUnix(local->second);
+			if (socketFd != -1) return socketFd;
+			// otherwise fall back to tcp
+		}
+		
+	    // Create a TCP socket
+	    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+		if (socketFd == -1) {
+	        std::cerr << "Error creating socket" << std::endl;
+	        return -1;
+	    }
+	
+	    // Set up the server address
+	    struct sockaddr_in serverAddr;
+	    std::memset(&serverAddr, 0, sizeof(serverAddr));
+	    serverAddr.sin_family = AF_INET;
+	    serverAddr.sin_port = htons(serverPort);
+	    if (inet_pton(AF_INET, (serverIP == "localhost" ? "127.0.0.1" : serverIP.c_str()), &serverAddr.sin_addr) != 1) {
+	        std::cerr << "Invalid server IP address" << std::endl;
+	        close(socketFd);
+	        return -1;
+	    }
+	
+	    // Connect to the server
+	    if (connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == -1) {
+	        std::cerr << "Error connecting to server" << std::endl;
+	        close(socketFd);
+	        return -1;
+	    }
+	    return socketFd;
+	}
 };
+
+map<int, string> TcpClient::local_sockets;
\ No newline at end of file
@@ -0,0 +1,172 @@
+/**********************************************************
+* Copyright 2025 Andrea Sorato.
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS AS IS AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+* OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+* OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* This file is part of iuni-ljus. Official website: iuni-ljus.org . 
+***********************************************************/
+
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <cstring>
+#include <unistd.h>
+
+/* minimal io_uring ring over the raw syscalls (no liburing needed)
+   usage:
+     Uring ring;
+     if (ring.init(8)) {
+         io_uring_sqe* e = ring.sqe();
+         e->opcode = IORING_OP_WRITE; e->fd = fd; e->addr = (unsigned long)buf; e->len = n; e->off = -1;
+         ring.submit(1);            // submit everything prepared, wait one completion
+         int res; ring.reap(res);   // res as the syscall return value (-errno on error), see also sqe user_data
+     }
+*/
+class Uring {
+	int ring_fd = -1;
+	
+	void* sq_ptr = MAP_FAILED;
+	void* cq_ptr = MAP_FAILED;
+	size_t sq_len = 0, cq_len = 0, sqes_len = 0;
+	
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	io_uring_sqe* sqes = (io_uring_sqe*)MAP_FAILED;
+	io_uring_cqe* cqes;
+	
+	unsigned prepared = 0; // sqes filled but not submitted yet
+	
+	static unsigned loadAcquire(unsigned* p) {
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+	}
+	
+	static void storeRelease(unsigned* p, unsigned v) {
+		__atomic_store_n(p, v, __ATOMIC_RELEASE);
+	}
+	
+public:
+	Uring() {}
+	Uring(const Uring&) = delete;
+	
+	bool init(unsigned entries) {
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		ring_fd = syscall(__NR_io_uring_setup, entries, &p);
+		if (ring_fd < 0) return false;
+		
+		sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		cq_len = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		sqes_len = p.sq_entries * sizeof(io_uring_sqe);
+		
+		sq_ptr = mmap(0, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+		cq_ptr = mmap(0, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		sqes = (io_uring_sqe*)mmap(0, sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+		if (sq_ptr == MAP_FAILED or cq_ptr == MAP_FAILED or sqes == MAP_FAILED) {
+			release();
+			return false;
+		}
+		
+		char* sq = (char*)sq_ptr;
+		sq_head = (unsigned*)(sq + p.sq_off.head);
+		sq_tail = (unsigned*)(sq + p.sq_off.tail);
+		sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+		sq_array = (unsigned*)(sq + p.sq_off.array);
+		
+		char* cq = (char*)cq_ptr;
+		cq_head = (unsigned*)(cq + p.cq_off.head);
+		cq_tail = (unsigned*)(cq + p.cq_off.tail);
+		cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+		cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+		return true;
+	}
+	
+	bool ready() {
+		return ring_fd >= 0;
+	}
+	
+	/* next submission entry, zeroed; nullptr if the ring is full */
+	io_uring_sqe* sqe() {
+		unsigned tail = *sq_tail + prepared;
+		if (tail - loadAcquire(sq_head) > *sq_mask) return nullptr;
+		unsigned index = tail & *sq_mask;
+		io_uring_sqe* e = &sqes[index];
+		memset(e, 0, sizeof(*e));
+		sq_array[index] = index;
+		prepared++;
+		return e;
+	}
+	
+	/* submit the prepared entries and wait for wait_nr completions, with a single syscall */
+	int submit(unsigned wait_nr) {
+		storeRelease(sq_tail, *sq_tail + prepared);
+		unsigned to_submit = prepared;
+		prepared = 0;
+		int r;
+		do {
+			r = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		} while (r < 0 and errno == EINTR);
+		return r;
+	}
+	
+	/* pop one completion; false if none is available */
+	bool reap(int& res, unsigned long& user_data) {
+		unsigned head = *cq_head;
+		if (head == loadAcquire(cq_tail)) return false;
+		res = cqes[head & *cq_mask].res;
+		user_data = cqes[head & *cq_mask].user_data;
+		storeRelease(cq_head, head + 1);
+		return true;
+	}
+	
+	bool reap(int& res) {
+		unsigned long user_data;
+		return reap(res, user_data);
+	}
+	
+	/* the next completion, waiting for it if not there yet; false if io_uring_enter fails */
+	bool next(int& res, unsigned long& user_data) {
+		while (!reap(res, user_data))
+			if (submit(1) < 0) return false;
+		return true;
+	}
+	
+	bool next(int& res) {
+		unsigned long user_data;
+		return next(res, user_data);
+	}
+	
+	void release() {
+		if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_len);
+		if (cq_ptr != MAP_FAILED) munmap(cq_ptr, cq_len);
+		if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+		sq_ptr = cq_ptr = MAP_FAILED;
+		sqes = (io_uring_sqe*)MAP_FAILED;
+		if (ring_fd >= 0) ::close(ring_fd);
+		ring_fd = -1;
+		prepared = 0;
+	}
+	
+	~Uring() {
+		release();
+	}
+	
+	static bool available() {
+		Uring probe;
+		return probe.init(2);
+	}
+};
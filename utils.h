@@ -91,6 +91,10 @@ namespace Utils {
 		return static_cast<long>(time(nullptr));
 	}
 	
+	long getTimestampMs() {
+		return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+	}
+	
 	class UUIDgenerator {
 		long uuid = 0;
 		mutex mtx_uuid;
@@ -118,6 +122,22 @@ namespace Utils {
 		return z;
 	}
 	
+	/* str as an integer or a decimal number (e.g.: 3, -2, 1.50, 1e3) */
+	bool toNumber(const std::string& str, double& n) {
+		if (str.empty() or !(isdigit(str[0]) or str[0] == '-' or str[0] == '+' or str[0] == '.'))
+			return false;
+		char* end;
+		n = strtod(str.c_str(), &end);
+		return end == str.c_str() + str.size() and std::isfinite(n);
+	}
+	
+	/* shortest of the usual forms: 5.4, 12, 1e+20 */
+	std::string formatNumber(double n) {
+		std::ostringstream os;
+		os << std::setprecision(15) << n;
+		return os.str();
+	}
+	
 	bool isNaturalNumber(const std::string& str) {
 	    if (str.empty())
 	        return false;
@@ -129,6 +149,27 @@ namespace Utils {
 	    return true;
 	}
 
+	/* append n as LEB128 varint (7 bits per byte, high bit = more bytes follow) */
+	void putVarint(string& out, unsigned long n) {
+		while (n >= 0x80) {
+			out += (char)((n & 0x7F) | 0x80);
+			n >>= 7;
+		}
+		out += (char)n;
+	}
+	
+	/* read a varint at position 'at', advancing it; false if truncated or too long */
+	bool getVarint(const string& in, size_t& at, unsigned long& n) {
+		n = 0;
+		for (int shift = 0; shift < 64; shift += 7) {
+			if (at >= in.size()) return false;
+			unsigned char b = in[at++];
+			n |= (unsigned long)(b & 0x7F) << shift;
+			if (!(b & 0x80)) return true;
+		}
+		return false;
+	}
+
 	std::string replaceAll(std::string str, const std::string& from, const std::string& to) {
 		size_t pos = 0;
 		while ((pos = str.find(from, pos)) != std::string::npos) {
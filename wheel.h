@@ -0,0 +1,116 @@
+/**********************************************************
+* Copyright 2025 Andrea Sorato.
+*
+* Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+*
+* 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+*
+* 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+*
+* 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS AS IS AND ANY EXPRESS OR IMPLIED WARRANTIES, 
+* INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, 
+* OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+* OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+* This file is part of iuni-ljus. Official website: iuni-ljus.org . 
+***********************************************************/
+
+
+
+#include <cstddef>
+#include <algorithm>
+#include <deque>
+#include <utility>
+#include <vector>
+
+/* hierarchical timer wheel: the timers (id, deadline in ticks) in LEVELS levels of 64 slots, a slot of a level as long as the
+   whole level below. A timer waits in the finest level whose slots reach its deadline and goes down a level each time the
+   wheel gets to its slot, so adding a timer and taking it when due cost the same whatever the timers waiting
+   usage:
+     TimerWheel wheel;
+     wheel.advance(now, due);                   // to the present first: the timers whose deadline is <= now appended to due
+     wheel.add(id, deadline);                   // deadline in ticks (e.g. ms), in the past too: due at the next advance
+   a timer is not cancelled: the caller skips the due ones no more valid */
+class TimerWheel {
+public:
+	typedef std::pair<long, long> Timer; // id, deadline
+	
+private:
+	static const int BITS = 6;
+	static const int SLOTS = 1 << BITS;
+	static const int LEVELS = 6; // 2^36 ticks ahead: two years of ms
+	
+	std::vector<Timer> slots[LEVELS][SLOTS];
+	size_t waiting[LEVELS] = {}; // timers in the slots of each level
+	std::vector<Timer> later; // beyond the last level
+	std::vector<Timer> ready; // due already
+	long now = 0; // last tick done
+	size_t count = 0;
+	
+	void place(const Timer& t) {
+		if (t.second <= now) {
+			ready.push_back(t);
+			return;
+		}
+		for (int l = 0; l < LEVELS; l++)
+			if ((t.second >> (BITS * (l + 1))) == (now >> (BITS * (l + 1)))) { // the same slot in the levels above: ahead in this one
+				slots[l][(t.second >> (BITS * l)) & (SLOTS - 1)].push_back(t);
+				waiting[l]++;
+				return;
+			}
+		later.push_back(t);
+	}
+	
+	void cascade(int l, std::vector<Timer>& slot) {
+		std::vector<Timer> moving;
+		moving.swap(slot);
+		if (l < LEVELS) waiting[l] -= moving.size();
+		for (auto& t : moving) place(t);
+	}
+	
+	void take(std::vector<Timer>& slot, std::deque<Timer>& due) {
+		due.insert(due.end(), slot.begin(), slot.end());
+		count -= slot.size();
+		slot.clear();
+	}
+	
+public:
+	void add(long id, long deadline) {
+		place({id, deadline});
+		count++;
+	}
+	
+	/* up to the tick to, a tick at a time while the finest level has timers, otherwise from a slot to the next one of the
+	   finest level that has (with none, at once) */
+	void advance(long to, std::deque<Timer>& due) {
+		take(ready, due);
+		for (; now < to and count > 0; take(ready, due)) {
+			int finest = 0;
+			while (finest < LEVELS and waiting[finest] == 0) finest++;
+			if (finest > 0) now = std::min(to - 1, (((now >> (BITS * finest)) + 1) << (BITS * finest)) - 1); // nothing below changes before
+			now++;
+			int turned = 1; // the levels whose slot changes at this tick, the first one included
+			while (turned < LEVELS and (now & ((1L << (BITS * turned)) - 1)) == 0) turned++;
+			if (turned == LEVELS and (now & ((1L << (BITS * LEVELS)) - 1)) == 0) cascade(LEVELS, later);
+			for (int l = turned - 1; l > 0; l--) cascade(l, slots[l][(now >> (BITS * l)) & (SLOTS - 1)]); // the coarsest first
+			waiting[0] -= slots[0][now & (SLOTS - 1)].size();
+			take(slots[0][now & (SLOTS - 1)], due);
+		}
+		if (now < to) now = to;
+	}
+	
+	void clear() {
+		for (auto& level : slots)
+			for (auto& slot : level) slot.clear();
+		for (auto& w : waiting) w = 0;
+		later.clear();
+		ready.clear();
+		count = 0;
+	}
+	
+	size_t size() { return count; }
+};